@@ -15,6 +15,7 @@
 #include <limits.h>
 #include <inttypes.h>
 #include <arpa/inet.h>
+#include <sys/stat.h>
 
 #include "list.h"
 #include "lnxconfig.h"
@@ -48,12 +49,73 @@ void parse_addr(char *ip_str, struct in_addr *addr)
   }
 }
 
-// Add a struct to one of the linked lists
-#define add_config(config_field, template, T)	\
+// A chunk of memory for lnxconfig_parse_arena.  Records are carved
+// off the front of the newest chunk; when it fills up, a new chunk
+// (twice as large) is pushed in front of it.
+struct lnx_arena {
+    struct lnx_arena *next; // Previous (older) chunk
+    size_t used;
+    size_t size;
+};
+
+#define ARENA_ALIGN 16
+#define ARENA_HDR ((sizeof(struct lnx_arena) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define ARENA_MIN_CHUNK 4096
+
+static lnx_arena_t *arena_new_chunk(lnx_arena_t *next, size_t size) {
+    lnx_arena_t *chunk = (lnx_arena_t *)malloc(ARENA_HDR + size);
+    if (chunk == NULL) {
+	do_abort("malloc");
+    }
+    chunk->next = next;
+    chunk->used = 0;
+    chunk->size = size;
+    return chunk;
+}
+
+static void *arena_alloc(lnx_arena_t **arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    lnx_arena_t *chunk = *arena;
+    if (chunk->size - chunk->used < size) {
+	size_t grow = chunk->size * 2;
+	if (grow < size) {
+	    grow = size;
+	}
+	chunk = arena_new_chunk(chunk, grow);
+	*arena = chunk;
+    }
+
+    void *p = (char *)chunk + ARENA_HDR + chunk->used;
+    chunk->used += size;
+    return p;
+}
+
+// Allocate a record for `config`, from its arena if it has one
+static void *config_alloc(lnxconfig_t *config, size_t size) {
+    if (config->arena != NULL) {
+	return arena_alloc(&config->arena, size);
+    }
+    return malloc(size);
+}
+
+// Add a struct to one of the linked lists.  If the config has an array
+// for `field`, the record takes the next slot in it (up to the count
+// found by count_records), otherwise it gets an allocation of its own.
+#define add_config(config, field, cap, template, T)	\
     do { \
-	T *__item = (T *)malloc(sizeof(T));		  \
+	T *__item;					\
+	if ((config)->field##_array != NULL) {		\
+	    if ((config)->num_##field == (cap).field) {	\
+		do_parse_error("File changed while parsing");	\
+	    }						\
+	    __item = &(config)->field##_array[(config)->num_##field]; \
+	} else {					\
+	    __item = (T *)config_alloc((config), sizeof(T));	\
+	}						\
+	(config)->num_##field++;			\
 	memcpy(__item, template, sizeof(T));		  \
-	list_insert_tail((config_field), &__item->link);  \
+	list_insert_tail(&(config)->field, &__item->link);  \
     } while(0)
 
 // Free all ements in one of the lists
@@ -67,7 +129,73 @@ void parse_addr(char *ip_str, struct in_addr *addr)
     } while(0)
 
 
-lnxconfig_t *lnxconfig_parse(char *config_file) {
+// Free the records for one directive: a single free if they live in
+// an array, otherwise one per list node
+#define config_free_records(config, field, T) \
+    do { \
+	if ((config)->field##_array != NULL) {		\
+	    free((config)->field##_array);		\
+	} else {					\
+	    config_clear(&(config)->field, T);		\
+	}						\
+    } while(0)
+
+// Number of records of each kind in a file
+typedef struct {
+    size_t interfaces;
+    size_t neighbors;
+    size_t rip_neighbors;
+    size_t static_routes;
+} record_counts_t;
+
+// First pass for lnxconfig_parse_arrays: count the lines that will
+// become records, recognizing them the same way do_parse does, then
+// rewind the file.  Malformed lines are left for the real pass to report.
+static void count_records(FILE *f, record_counts_t *counts) {
+    char buf[LINE_MAX];
+    char first_token[TOKEN_MAX_NAME];
+    char second_token[TOKEN_MAX_NAME];
+
+    memset(counts, 0, sizeof(record_counts_t));
+    while (fgets(buf, LINE_MAX, f) != NULL) {
+	memset(first_token, 0, TOKEN_MAX_NAME);
+	memset(second_token, 0, TOKEN_MAX_NAME);
+
+	if (buf[0] == '#' || sscanf(buf, "%10s", first_token) != 1) {
+	    continue;
+	}
+
+	if (strncmp(first_token, "interface", TOKEN_MAX_NAME) == 0) {
+	    counts->interfaces++;
+	} else if (strncmp(first_token, "neighbor", TOKEN_MAX_NAME) == 0) {
+	    counts->neighbors++;
+	} else if (strncmp(first_token, "route", TOKEN_MAX_NAME) == 0) {
+	    counts->static_routes++;
+	} else if (strncmp(first_token, "rip", TOKEN_MAX_NAME) == 0 &&
+		   sscanf(buf, "rip %32s", second_token) == 1 &&
+		   strncmp(second_token, "advertise-to", TOKEN_MAX_NAME) == 0) {
+	    counts->rip_neighbors++;
+	}
+    }
+    rewind(f);
+}
+
+// Allocate exactly `n` records for one of the config's arrays
+static void *config_array(lnxconfig_t *config, size_t n, size_t size) {
+    if (n == 0) {
+	return NULL;
+    }
+    void *p = config_alloc(config, n * size);
+    if (p == NULL) {
+	do_abort("malloc");
+    }
+    return p;
+}
+
+#define PARSE_ARENA  0x1
+#define PARSE_ARRAYS 0x2
+
+static lnxconfig_t *do_parse(char *config_file, int flags) {
     FILE *f;
     lnxconfig_t *config;
 
@@ -79,19 +207,45 @@ lnxconfig_t *lnxconfig_parse(char *config_file) {
     char ip_buf1[LINE_MAX];
     char ip_buf2[LINE_MAX];
     char first_token[TOKEN_MAX_NAME];
+    record_counts_t cap;
 
     if ((f = fopen(config_file, "r")) == NULL) {
 	perror("fopen");
 	exit(1);
     }
+    g_current_line = 0;
+
+    if (flags & PARSE_ARENA) {
+	// Size the first chunk from the file so that it normally holds
+	// every record: each line becomes at most ~3x its length in structs
+	struct stat st;
+	size_t hint = ARENA_MIN_CHUNK;
+	if (fstat(fileno(f), &st) == 0 && (size_t)st.st_size * 3 > hint) {
+	    hint = (size_t)st.st_size * 3;
+	}
 
-    config = (lnxconfig_t *)malloc(sizeof(lnxconfig_t));
-    memset(config, 0, sizeof(lnxconfig_t));
+	lnx_arena_t *arena = arena_new_chunk(NULL, hint + sizeof(lnxconfig_t));
+	config = (lnxconfig_t *)arena_alloc(&arena, sizeof(lnxconfig_t));
+	memset(config, 0, sizeof(lnxconfig_t));
+	config->arena = arena;
+    } else {
+	config = (lnxconfig_t *)malloc(sizeof(lnxconfig_t));
+	memset(config, 0, sizeof(lnxconfig_t));
+    }
     list_init(&config->interfaces);
     list_init(&config->neighbors);
     list_init(&config->rip_neighbors);
     list_init(&config->static_routes);
 
+    memset(&cap, 0, sizeof(cap));
+    if (flags & PARSE_ARRAYS) {
+	count_records(f, &cap);
+	config->interfaces_array = config_array(config, cap.interfaces, sizeof(lnx_interface_t));
+	config->neighbors_array = config_array(config, cap.neighbors, sizeof(lnx_neighbor_t));
+	config->rip_neighbors_array = config_array(config, cap.rip_neighbors, sizeof(lnx_rip_neighbor_t));
+	config->static_routes_array = config_array(config, cap.static_routes, sizeof(lnx_static_route_t));
+    }
+
     // Set default config values
     config->routing_mode = ROUTING_MODE_STATIC; // Set as default unless otherwise specified
     config->rip_periodic_update_rate_ms = DEFAULT_RIP_PERIODIC_UPDATE_RATE_MS;
@@ -136,7 +290,7 @@ lnxconfig_t *lnxconfig_parse(char *config_file) {
 	    parse_addr(ip_buf2, &f_iface.udp_addr);
 	    f_iface.udp_port = (uint16_t)port;
 
-	    add_config(&config->interfaces, &f_iface, lnx_interface_t);
+	    add_config(config, interfaces, cap, &f_iface, lnx_interface_t);
 	} else if ((strncmp(first_token, "neighbor", TOKEN_MAX_NAME)) == 0) {
 	    tokens = sscanf(line, "neighbor %32s at %32[^:]:%d via %32[^ #]",
 			    ip_buf1, ip_buf2, &port, f_neighbor.ifname);
@@ -147,7 +301,7 @@ lnxconfig_t *lnxconfig_parse(char *config_file) {
 	    parse_addr(ip_buf1, &f_neighbor.dest_addr);
 	    parse_addr(ip_buf2, &f_neighbor.udp_addr);
 	    f_neighbor.udp_port = (uint16_t)port;
-	    add_config(&config->neighbors, &f_neighbor, lnx_neighbor_t);
+	    add_config(config, neighbors, cap, &f_neighbor, lnx_neighbor_t);
 	} else if ((strncmp(first_token, "routing", TOKEN_MAX_NAME) == 0)) {
 	    char *mode_str = ip_buf1; // Reuse this buffer
 	    tokens = sscanf(line, "routing %32s", mode_str);
@@ -188,7 +342,7 @@ lnxconfig_t *lnxconfig_parse(char *config_file) {
 		    do_parse_error("Did not find enough tokens");
 		}
 		parse_addr(ip_buf1, &f_advertise_to.dest);
-		add_config(&config->rip_neighbors, &f_advertise_to, lnx_rip_neighbor_t);
+		add_config(config, rip_neighbors, cap, &f_advertise_to, lnx_rip_neighbor_t);
 	    } else {
 		do_parse_error("Unrecognized RIP directive");
 	    }
@@ -201,7 +355,7 @@ lnxconfig_t *lnxconfig_parse(char *config_file) {
 
 	    parse_addr(ip_buf1, &f_route.network_addr);
 	    parse_addr(ip_buf2, &f_route.next_hop);
-	    add_config(&config->static_routes, &f_route, lnx_static_route_t);
+	    add_config(config, static_routes, cap, &f_route, lnx_static_route_t);
 	} else if (strncmp(first_token, "tcp", TOKEN_MAX_NAME) == 0) {
 	    char second_token[TOKEN_MAX_NAME];
 	    memset(second_token, 0, TOKEN_MAX_NAME);
@@ -233,16 +387,40 @@ lnxconfig_t *lnxconfig_parse(char *config_file) {
     return config;
 }
 
+lnxconfig_t *lnxconfig_parse(char *config_file) {
+    return do_parse(config_file, 0);
+}
+
+lnxconfig_t *lnxconfig_parse_arena(char *config_file) {
+    return do_parse(config_file, PARSE_ARENA);
+}
+
+lnxconfig_t *lnxconfig_parse_arrays(char *config_file) {
+    return do_parse(config_file, PARSE_ARRAYS);
+}
+
 
 void lnxconfig_destroy(lnxconfig_t *config) {
     if (config == NULL) {
 	return;
     }
 
-    config_clear(&config->interfaces, lnx_interface_t);
-    config_clear(&config->neighbors, lnx_neighbor_t);
-    config_clear(&config->rip_neighbors, lnx_rip_neighbor_t);
-    config_clear(&config->static_routes, lnx_static_route_t);
+    if (config->arena != NULL) {
+	// The config itself lives in the oldest chunk, so don't touch it
+	// once freeing has started
+	lnx_arena_t *chunk = config->arena;
+	while (chunk != NULL) {
+	    lnx_arena_t *next = chunk->next;
+	    free(chunk);
+	    chunk = next;
+	}
+	return;
+    }
+
+    config_free_records(config, interfaces, lnx_interface_t);
+    config_free_records(config, neighbors, lnx_neighbor_t);
+    config_free_records(config, rip_neighbors, lnx_rip_neighbor_t);
+    config_free_records(config, static_routes, lnx_static_route_t);
 
     free(config);
 }
@@ -70,6 +70,9 @@ typedef struct {
 } lnx_static_route_t;
 
 
+// Bump allocator backing a config parsed with lnxconfig_parse_arena
+typedef struct lnx_arena lnx_arena_t;
+
 // Top-level struct that represents the lnx file
 typedef struct {
     list_t interfaces;    // list of type lnx_interface_t
@@ -86,11 +89,54 @@ typedef struct {
     // TCP timing parameters (hosts only)
     uint64_t tcp_rto_min_us; // in microseconds
     uint64_t tcp_rto_max_us; // in microseconds
+
+    // Number of records in each list above
+    size_t num_interfaces;
+    size_t num_neighbors;
+    size_t num_rip_neighbors;
+    size_t num_static_routes;
+
+    // With lnxconfig_parse_arrays, the same records stored contiguously
+    // in file order (NULL otherwise, or if there are none).  The lists
+    // above link through these elements, so both views stay usable.
+    lnx_interface_t *interfaces_array;
+    lnx_neighbor_t *neighbors_array;
+    lnx_rip_neighbor_t *rip_neighbors_array;
+    lnx_static_route_t *static_routes_array;
+
+    lnx_arena_t *arena; // NULL unless parsed with lnxconfig_parse_arena
 } lnxconfig_t;
 
+// Iterate over one of the arrays of a config parsed with
+// lnxconfig_parse_arrays (`field` is the list name), e.g.:
+//
+//   lnx_interface_t *iface;
+//   lnx_array_iterate(config, interfaces, iface) {
+//       ...
+//   }
+//
+// Visits nothing if the config has no array for `field`.
+#define lnx_array_iterate(config, field, var)				\
+    for ((var) = (config)->field##_array;				\
+	 (var) != NULL && (var) < (config)->field##_array + (config)->num_##field; \
+	 (var)++)
+
 // Parse the config
 lnxconfig_t *lnxconfig_parse(char *config_file);
 
+// Parse the config, placing the lnxconfig_t and all of its records in a
+// few large chunks (usually one) instead of one malloc per record.
+// lnxconfig_destroy then frees the whole config in one go.  Since the
+// records are not individually malloc'd, don't free() them yourself.
+lnxconfig_t *lnxconfig_parse_arena(char *config_file);
+
+// Parse the config, storing the records of each directive in one
+// exactly-sized array (see interfaces_array etc. and lnx_array_iterate)
+// instead of one malloc per record.  Reads the file twice: once to
+// count, once to parse.  As with lnxconfig_parse_arena, don't free() or
+// list_remove individual records.
+lnxconfig_t *lnxconfig_parse_arrays(char *config_file);
+
 // Free the config
 void lnxconfig_destroy(lnxconfig_t *config);
 
@@ -0,0 +1,350 @@
+/*
+ * bench.cpp - Parser benchmarks
+ *
+ * Generates lnx files of 1k to 1M lines and times each way of loading
+ * them: the C++ parser's entry points, binary snapshots, loading many
+ * files at once, and the C parser in ../c.  Build with `make bench`.
+ *
+ * Usage:
+ *   ./bench [--lines N] [filter]      Run benchmarks whose name contains
+ *                                     `filter`, on files of N lines (by
+ *                                     default 1k, 10k, 100k and 1M)
+ *   ./bench --generate N <file>       Just write an N-line file
+ *
+ * For each benchmark, prints the time per iteration, lines and bytes
+ * parsed per second, and heap allocations per line.
+ */
+
+#include "lnxconfig.h"
+#include "lnxload.h"
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+// The C parser, linked in from ../c/lnxconfig.c.  Only handles are
+// passed around here, so its structs are left opaque.
+extern "C" {
+	struct lnxconfig_t;
+	lnxconfig_t *lnxconfig_parse(char *config_file);
+	lnxconfig_t *lnxconfig_parse_arena(char *config_file);
+	lnxconfig_t *lnxconfig_parse_arrays(char *config_file);
+	void lnxconfig_destroy(lnxconfig_t *config);
+}
+
+// Count allocations by interposing malloc, which operator new and the C
+// parser both end up in
+static size_t g_mallocs = 0;
+
+#ifdef __GLIBC__
+extern "C" void *__libc_malloc(size_t size);
+
+extern "C" void *malloc(size_t size) noexcept {
+	g_mallocs++;
+	return __libc_malloc(size);
+}
+#endif
+
+static constexpr double MIN_TIME_S = 0.5;
+
+// Copies of the input for load_many
+static constexpr size_t LOAD_MANY_FILES = 16;
+
+struct Input {
+	size_t lines;
+	std::string text;
+	std::string path;
+	std::string snapshot_path;
+	std::vector<std::string> copy_paths;
+};
+
+struct Benchmark {
+	const char *name;
+	std::function<void(const Input &)> run;
+
+	// Copies of the input one run parses, so that lines and bytes per
+	// second count all of them
+	size_t files = 1;
+};
+
+/**
+ * Small deterministic PRNG (xorshift64*), so that every run generates
+ * the same files
+ */
+class Rng {
+public:
+    explicit Rng(uint64_t seed) : m_state(seed) {}
+
+    uint32_t next(uint32_t bound) {
+	m_state ^= m_state >> 12;
+	m_state ^= m_state << 25;
+	m_state ^= m_state >> 27;
+	return (uint32_t) ((m_state * 2685821657736338717ull) >> 32) % bound;
+    }
+
+private:
+    uint64_t m_state;
+};
+
+/**
+ * Produce a valid lnx file of exactly `lines` lines, shaped like a
+ * large router config: a block of interfaces, then neighbors on those
+ * interfaces, static routes and advertise-to lines, mixed with
+ * comments and blank lines.
+ */
+static std::string generate(size_t lines) {
+	Rng rng(0x6c6e78);
+	std::string out;
+	char buf[128];
+	size_t n = 0;
+
+	auto emit = [&](const char *line) {
+		if (n < lines) {
+			out += line;
+			out += '\n';
+			n++;
+		}
+	};
+
+	emit("# Generated by bench --generate");
+	emit("routing rip");
+	emit("rip periodic-update-rate 5000");
+	emit("rip route-timeout-threshold 12000");
+
+	size_t n_ifaces = std::max<size_t>(1, lines / 100);
+	for (size_t i = 0; i < n_ifaces; i++) {
+		snprintf(buf, sizeof(buf), "interface if%zu 10.%zu.%zu.1/24 127.0.0.1:%zu",
+			 i, (i >> 8) & 0xff, i & 0xff, 5000 + i % 60000);
+		emit(buf);
+	}
+
+	while (n < lines) {
+		uint32_t kind = rng.next(100);
+		uint32_t iface = rng.next((uint32_t) n_ifaces);
+		uint32_t host = 2 + rng.next(253);
+
+		if (kind < 5) {
+			emit("# ---- neighbors and routes ----");
+		} else if (kind < 10) {
+			emit("");
+		} else if (kind < 30) {
+			snprintf(buf, sizeof(buf), "neighbor 10.%u.%u.%u at 127.0.0.1:%u via if%u",
+				 (iface >> 8) & 0xff, iface & 0xff, host, 5000 + rng.next(60000), iface);
+			emit(buf);
+		} else if (kind < 40) {
+			snprintf(buf, sizeof(buf), "rip advertise-to 10.%u.%u.%u",
+				 (iface >> 8) & 0xff, iface & 0xff, host);
+			emit(buf);
+		} else {
+			int prefix_len = 8 + rng.next(23);
+			uint32_t net = (172u << 24) | (rng.next(1u << 16) << 8) | rng.next(256);
+			net &= ~(uint32_t) 0 << (32 - prefix_len);
+			snprintf(buf, sizeof(buf), "route %u.%u.%u.%u/%d via 10.%u.%u.%u%s",
+				 net >> 24, (net >> 16) & 0xff, (net >> 8) & 0xff, net & 0xff,
+				 prefix_len, (iface >> 8) & 0xff, iface & 0xff, host,
+				 kind < 45 ? "  # upstream" : "");
+			emit(buf);
+		}
+	}
+	return out;
+}
+
+static bool write_file(const std::string &path, const std::string &text) {
+	FILE *f = fopen(path.c_str(), "w");
+	if (f == NULL) {
+		perror("fopen");
+		return false;
+	}
+	bool ok = fwrite(text.data(), 1, text.size(), f) == text.size();
+	return fclose(f) == 0 && ok;
+}
+
+// Keep the optimizer from discarding a result
+template <typename T>
+static void keep(const T &value) {
+	asm volatile("" : : "r"(&value) : "memory");
+}
+
+struct CountingVisitor : lnx::Visitor {
+	size_t directives = 0;
+
+	void on_interface(const lnx::InterfaceView &, int) { directives++; }
+	void on_neighbor(const lnx::NeighborView &, int) { directives++; }
+	void on_route(const lnx::StaticRoute &, int) { directives++; }
+	void on_rip(const lnx::RIPDirective &, int) { directives++; }
+};
+
+static std::vector<Benchmark> benchmarks() {
+	return {
+		{"Config(path)", [](const Input &in) {
+			lnx::Config c(in.path.c_str());
+			keep(c);
+		}},
+		{"Config::from_string", [](const Input &in) {
+			lnx::ParseError err;
+			auto c = lnx::Config::from_string(in.text, err);
+			keep(c);
+		}},
+		{"parse/visitor", [](const Input &in) {
+			CountingVisitor v;
+			lnx::ParseError err;
+			lnx::parse(in.text, v, err);
+			keep(v.directives);
+		}},
+		{"Config::load_snapshot", [](const Input &in) {
+			lnx::ParseError err;
+			auto c = lnx::Config::load_snapshot(in.snapshot_path.c_str(), err);
+			keep(c);
+		}},
+		{"Config::load_cached", [](const Input &in) {
+			lnx::ParseError err;
+			auto c = lnx::Config::load_cached(in.path.c_str(), in.snapshot_path.c_str(), err);
+			keep(c);
+		}},
+		{"load_many", [](const Input &in) {
+			auto results = lnx::load_many(in.copy_paths);
+			keep(results);
+		}, LOAD_MANY_FILES},
+		{"c/lnxconfig_parse", [](const Input &in) {
+			lnxconfig_destroy(lnxconfig_parse((char *) in.path.c_str()));
+		}},
+		{"c/lnxconfig_parse_arena", [](const Input &in) {
+			lnxconfig_destroy(lnxconfig_parse_arena((char *) in.path.c_str()));
+		}},
+		{"c/lnxconfig_parse_arrays", [](const Input &in) {
+			lnxconfig_destroy(lnxconfig_parse_arrays((char *) in.path.c_str()));
+		}},
+	};
+}
+
+static std::string human(double v, const char *unit) {
+	const char *prefixes[] = {"", "k", "M", "G"};
+	int p = 0;
+	while (v >= 1000 && p < 3) {
+		v /= 1000;
+		p++;
+	}
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.1f%s%s", v, prefixes[p], unit);
+	return buf;
+}
+
+static std::string human_time(double s) {
+	const char *units[] = {"s", "ms", "us", "ns"};
+	int u = 0;
+	while (s < 1 && u < 3) {
+		s *= 1000;
+		u++;
+	}
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.1f%s", s, units[u]);
+	return buf;
+}
+
+static void run(const Benchmark &b, const Input &in) {
+	using clock = std::chrono::steady_clock;
+
+	b.run(in); // Warm up caches and the page cache
+
+	size_t iters = 0;
+	size_t mallocs = g_mallocs;
+	auto start = clock::now();
+	double elapsed;
+	do {
+		b.run(in);
+		iters++;
+		elapsed = std::chrono::duration<double>(clock::now() - start).count();
+	} while (elapsed < MIN_TIME_S);
+	mallocs = g_mallocs - mallocs;
+
+	double per_iter = elapsed / iters;
+	double lines = (double) in.lines * b.files;
+	std::string name = std::string(b.name) + "/" + std::to_string(in.lines);
+	if (b.files > 1) {
+		name += "x" + std::to_string(b.files);
+	}
+	printf("%-34s %12s %8zu %12s %12s %12.3f\n", name.c_str(),
+	       human_time(per_iter).c_str(), iters,
+	       human(lines / per_iter, "/s").c_str(),
+	       human((double) in.text.size() * b.files / per_iter, "B/s").c_str(),
+	       (double) mallocs / (iters * lines));
+	fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+	std::vector<size_t> sizes = {1000, 10000, 100000, 1000000};
+	std::string filter;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--generate" && i + 2 < argc) {
+			return write_file(argv[i + 2], generate(strtoul(argv[i + 1], NULL, 10))) ? 0 : 1;
+		} else if (arg == "--lines" && i + 1 < argc) {
+			sizes = {strtoul(argv[++i], NULL, 10)};
+		} else if (arg[0] == '-') {
+			fprintf(stderr, "Usage: %s [--lines N] [filter]\n"
+				"       %s --generate N <file>\n", argv[0], argv[0]);
+			return 1;
+		} else {
+			filter = arg;
+		}
+	}
+
+	char dir[] = "/tmp/lnxbench.XXXXXX";
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+
+#ifndef __GLIBC__
+	fprintf(stderr, "warning: allocation counts need glibc, reporting 0\n");
+#endif
+	printf("%-34s %12s %8s %12s %12s %12s\n", "Benchmark", "Time", "Iters",
+	       "Lines", "Bytes", "Allocs/line");
+
+	int status = 0;
+	for (size_t lines : sizes) {
+		Input in;
+		in.lines = lines;
+		in.text = generate(lines);
+		in.path = std::string(dir) + "/bench.lnx";
+		in.snapshot_path = std::string(dir) + "/bench.lnxs";
+
+		// load_cached also writes the snapshot used by the snapshot benchmarks
+		lnx::ParseError err = {0, "Failed to write input"};
+		if (!write_file(in.path, in.text) ||
+		    !lnx::Config::load_cached(in.path.c_str(), in.snapshot_path.c_str(), err)) {
+			fprintf(stderr, "Failed to set up %zu-line input: line %d: %s\n",
+				lines, err.lineno, err.msg.c_str());
+			status = 1;
+			break;
+		}
+		for (size_t k = 0; k < LOAD_MANY_FILES; k++) {
+			in.copy_paths.push_back(std::string(dir) + "/bench-" + std::to_string(k) + ".lnx");
+			if (link(in.path.c_str(), in.copy_paths.back().c_str()) < 0) {
+				perror("link");
+				status = 1;
+				break;
+			}
+		}
+		if (status != 0) {
+			break;
+		}
+
+		for (const Benchmark &b : benchmarks()) {
+			if (std::string(b.name).find(filter) != std::string::npos) {
+				run(b, in);
+			}
+		}
+
+		unlink(in.path.c_str());
+		unlink(in.snapshot_path.c_str());
+		for (const std::string &p : in.copy_paths) {
+			unlink(p.c_str());
+		}
+	}
+
+	rmdir(dir);
+	return status;
+}
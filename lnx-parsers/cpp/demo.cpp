@@ -6,14 +6,22 @@ void print_interface(const lnx::Interface &interface);
 void print_neighbor(const lnx::Neighbor &neighbor);
 void print_static_route(const lnx::StaticRoute &static_route);
 void print_rip_neighbor(const lnx::RIPNeighbor &rip_neighbor);
+void print_stats(const lnx::ParseStats &stats);
 
 int main(int argc, char **argv) {
-	if (argc != 2) {
-		std::cerr << "Usage: " << argv[0] << " <lnx file>" << std::endl;
+	bool stats = argc == 3 && std::string(argv[1]) == "--stats";
+	if (argc != 2 && !stats) {
+		std::cerr << "Usage: " << argv[0] << " [--stats] <lnx file>" << std::endl;
 		return 1;
 	}
 
-	lnx::Config conf(argv[1]);
+	lnx::Config conf(argv[argc - 1]);
+	if (stats) {
+		// Print how the parse went as JSON instead of the config
+		print_stats(conf.stats());
+		return 0;
+	}
+
 	for (auto &i : conf.interfaces()) print_interface(i);
 	for (auto &n : conf.neighbors()) print_neighbor(n);
 	std::cout << "routing " << (conf.routing_mode() == lnx::RoutingMode::RIP ? "rip" : "static") << std::endl;
@@ -63,3 +71,31 @@ void print_static_route(const lnx::StaticRoute &static_route) {
 void print_rip_neighbor(const lnx::RIPNeighbor &rip_neighbor) {
 	std::cout << "rip advertise-to " << addr_to_str(&rip_neighbor.dest) << std::endl;
 }
+
+void print_stats(const lnx::ParseStats &stats) {
+	std::pair<const char *, uint64_t> fields[] = {
+		{"read_cycles", stats.read_cycles},
+		{"tokenize_cycles", stats.tokenize_cycles},
+		{"addr_cycles", stats.addr_cycles},
+		{"build_cycles", stats.build_cycles},
+		{"index_cycles", stats.index_cycles},
+		{"bytes_read", stats.bytes_read},
+		{"lines", stats.lines},
+		{"blank_lines", stats.blank_lines},
+		{"interface_lines", stats.interface_lines},
+		{"neighbor_lines", stats.neighbor_lines},
+		{"routing_lines", stats.routing_lines},
+		{"route_lines", stats.route_lines},
+		{"rip_lines", stats.rip_lines},
+		{"tcp_lines", stats.tcp_lines},
+		{"unknown_lines", stats.unknown_lines},
+		{"allocations", stats.allocations},
+		{"peak_bytes", stats.peak_bytes},
+	};
+
+	std::cout << "{\"enabled\": " << (stats.enabled ? "true" : "false");
+	for (auto &f : fields) {
+		std::cout << ", \"" << f.first << "\": " << f.second;
+	}
+	std::cout << "}" << std::endl;
+}
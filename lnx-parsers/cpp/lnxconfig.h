@@ -14,11 +14,49 @@
 #include <iostream>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
-#include <fstream>
 #include <limits.h>
 #include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LNX_IFNAME_MAX 64
+#define LNX_SOA_LANES 8
+
+/*
+ * Build with -DLNX_STATS=1 to have Config record where its parse time
+ * goes (see Config::stats()).  Off by default, in which case the
+ * instrumentation compiles away entirely.
+ */
+#ifndef LNX_STATS
+#define LNX_STATS 0
+#endif
+
+/*
+ * From C++20 the parser is constexpr, so that lnxconstexpr.h can run it
+ * at compile time.  Not in stats builds, whose timers only work at run
+ * time.
+ */
+#if LNX_STATS || __cplusplus < 202002L
+#define LNX_PARSE_CONSTEXPR
+#else
+#define LNX_PARSE_CONSTEXPR constexpr
+#endif
+
+#if LNX_STATS
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+#endif
 
 namespace lnx {
 
@@ -100,6 +138,19 @@ namespace lnx {
 		 * the interface used when sending packets to this neighbor.
 		 */
 		std::string ifname;
+
+		/**
+		 * Index of `ifname` in Config::interfaces(), resolved once the
+		 * whole file is parsed, or -1 if no interface has that name.
+		 */
+		int ifindex = -1;
+
+		/**
+		 * `udp_addr` and `udp_port` as a sockaddr_in (port in network
+		 * byte order), filled in with `ifindex`, to pass straight to
+		 * sendto/sendmmsg.
+		 */
+		sockaddr_in udp_sockaddr = {};
 	};
 
 	/**
@@ -137,25 +188,1013 @@ namespace lnx {
 		in_addr next_hop;
 	};
 
+	/**
+	 * View of an interface directive, as passed to Visitor::on_interface.
+	 * `name` points into the parser's input and is only valid for the
+	 * duration of the callback.
+	 */
+	struct InterfaceView {
+		std::string_view name;
+		in_addr assigned_ip;
+		int prefix_len;
+		in_addr udp_addr;
+		uint16_t udp_port;
+	};
+
+	/**
+	 * View of a neighbor directive, as passed to Visitor::on_neighbor.
+	 * `ifname` is only valid for the duration of the callback.
+	 */
+	struct NeighborView {
+		in_addr dest_addr;
+		in_addr udp_addr;
+		uint16_t udp_port;
+		std::string_view ifname;
+	};
+
+	/**
+	 * One `rip ...` directive.
+	 */
+	struct RIPDirective {
+		enum class Kind {
+			PERIODIC_UPDATE_RATE,    // rip periodic-update-rate <ms>
+			ROUTE_TIMEOUT_THRESHOLD, // rip route-timeout-threshold <ms>
+			ADVERTISE_TO,            // rip advertise-to <addr>
+		};
+
+		Kind kind;
+
+		/**
+		 * Value in milliseconds, for the two timing directives
+		 */
+		uint64_t value_ms;
+
+		/**
+		 * Neighbor to advertise to, for ADVERTISE_TO
+		 */
+		in_addr dest;
+	};
+
+	/**
+	 * One `tcp ...` directive.
+	 */
+	struct TCPDirective {
+		enum class Kind {
+			RTO_MIN, // tcp rto-min <us>
+			RTO_MAX, // tcp rto-max <us>
+		};
+
+		Kind kind;
+
+		/**
+		 * Value in microseconds
+		 */
+		uint64_t value_us;
+	};
+
+	/**
+	 * Streaming consumer of lnx directives.  Derive from this and redefine
+	 * only the hooks you need, then pass an instance to lnx::parse (or
+	 * lnx::parse_file), which calls the matching hook as soon as each line
+	 * is parsed.  Nothing is accumulated by the parser, so memory use does
+	 * not depend on the size of the file.
+	 *
+	 * lnx::parse is a template over the visitor type, so hooks are resolved
+	 * statically (no virtual calls) and the empty defaults compile away.
+	 * Each hook also gets the line number of the directive.
+	 */
+	class Visitor {
+	public:
+	    void on_interface(const InterfaceView &, int) {}
+	    void on_neighbor(const NeighborView &, int) {}
+	    void on_routing(RoutingMode, int) {}
+	    void on_route(const StaticRoute &, int) {}
+	    void on_rip(const RIPDirective &, int) {}
+	    void on_tcp(const TCPDirective &, int) {}
+	};
+
+	/**
+	 * Describes why an lnx file could not be parsed.
+	 */
+	struct ParseError {
+		/**
+		 * Line of the offending directive, or 0 if the error is not tied
+		 * to a line (e.g. the file could not be opened).
+		 */
+		int lineno;
+
+		std::string msg;
+	};
+
+	/**
+	 * Where a Config's parse spent its time and memory, as returned by
+	 * Config::stats().  Only filled in when built with LNX_STATS=1;
+	 * otherwise (and for configs loaded from snapshots) everything is 0.
+	 *
+	 * Times are in TSC ticks on x86 and nanoseconds elsewhere.  The
+	 * phases do not overlap:
+	 *  - read: opening and mapping the file, including faulting in its
+	 *    pages (stats builds map with MAP_POPULATE so I/O lands here)
+	 *  - tokenize: splitting lines and scanning words and numbers
+	 *  - addr: converting dotted-quad addresses
+	 *  - build: copying directives into the Config's vectors
+	 *  - index: resolving names and building lookup indexes (finish)
+	 */
+	struct ParseStats {
+		bool enabled = false;
+
+		uint64_t read_cycles = 0;
+		uint64_t tokenize_cycles = 0;
+		uint64_t addr_cycles = 0;
+		uint64_t build_cycles = 0;
+		uint64_t index_cycles = 0;
+
+		uint64_t bytes_read = 0;
+
+		uint64_t lines = 0;
+		uint64_t blank_lines = 0; // Empty or comment-only
+		uint64_t interface_lines = 0;
+		uint64_t neighbor_lines = 0;
+		uint64_t routing_lines = 0;
+		uint64_t route_lines = 0;
+		uint64_t rip_lines = 0;
+		uint64_t tcp_lines = 0;
+		uint64_t unknown_lines = 0;
+
+		/**
+		 * Heap allocations made for the Config's own storage (vector
+		 * growth, long names, indexes), and the most bytes it held at
+		 * once, counting both buffers while a vector grows
+		 */
+		uint64_t allocations = 0;
+		uint64_t peak_bytes = 0;
+		uint64_t live_bytes = 0;
+
+		// Time spent in the parse loop, before addr and build are
+		// taken out to get tokenize
+		uint64_t parse_cycles = 0;
+	};
+
+	namespace detail {
+#if LNX_STATS
+		/**
+		 * Stats of the Config currently being parsed on this thread, or
+		 * nullptr.  Set by StatsScope, so bare lnx::parse calls with
+		 * other visitors record nothing.
+		 */
+		inline thread_local ParseStats *stats_sink = nullptr;
+
+		inline uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+			return __rdtsc();
+#else
+			return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+		}
+
+		struct StatsScope {
+			ParseStats *saved;
+
+			StatsScope(ParseStats &stats) : saved(stats_sink) {
+				stats.enabled = true;
+				stats_sink = &stats;
+			}
+			~StatsScope() { stats_sink = saved; }
+		};
+
+		// Adds the cycles until the end of the enclosing scope to `field`
+		struct StatsTimer {
+			uint64_t ParseStats::*field;
+			uint64_t start;
+
+			StatsTimer(uint64_t ParseStats::*f) : field(f), start(stats_sink ? cycles() : 0) {}
+			~StatsTimer() {
+				if (stats_sink) {
+					stats_sink->*field += cycles() - start;
+				}
+			}
+		};
+
+		// Account for a buffer growing from `old_bytes` to `new_bytes`
+		inline void stats_grow(size_t old_bytes, size_t new_bytes) {
+			ParseStats *s = stats_sink;
+			if (s == nullptr || new_bytes == old_bytes) {
+				return;
+			}
+			s->allocations++;
+			if (s->live_bytes + new_bytes > s->peak_bytes) {
+				s->peak_bytes = s->live_bytes + new_bytes; // Old buffer still alive
+			}
+			s->live_bytes += new_bytes - old_bytes;
+		}
+#endif
+	}
+
+#if LNX_STATS
+#define LNX_STATS_SCOPE(stats) lnx::detail::StatsScope lnx_stats_scope_(stats)
+#define LNX_STATS_TIME(field) lnx::detail::StatsTimer lnx_stats_timer_(&lnx::ParseStats::field)
+#define LNX_STATS_ADD(field, n)						\
+	do {								\
+		if (lnx::detail::stats_sink != nullptr) {		\
+			lnx::detail::stats_sink->field += (n);		\
+		}							\
+	} while (0)
+#define LNX_STATS_GROW(old_bytes, new_bytes) lnx::detail::stats_grow(old_bytes, new_bytes)
+#else
+#define LNX_STATS_SCOPE(stats) do {} while (0)
+#define LNX_STATS_TIME(field) do {} while (0)
+#define LNX_STATS_ADD(field, n) do {} while (0)
+#define LNX_STATS_GROW(old_bytes, new_bytes) do {} while (0)
+#endif
+
+	/**
+	 * Parse the lnx directives in `text`, calling `visitor` for each one in
+	 * file order.  Stops at the first bad line, returning false and
+	 * describing the problem in `err`.  Directives before the bad line
+	 * have already been passed to the visitor.
+	 */
+	template <typename V>
+	LNX_PARSE_CONSTEXPR bool parse(std::string_view text, V &visitor, ParseError &err);
+
+	/**
+	 * Same as above, reading the file at `path` through a MappedFile.
+	 * Named apart from parse() so that a string literal or `char *`
+	 * holding lnx text is never taken for a path.
+	 */
+	template <typename V>
+	bool parse_file(const char *path, V &visitor, ParseError &err);
+
+	/**
+	 * Versions of the above that print the error and exit the process on
+	 * failure, like Config's constructor.
+	 */
+	template <typename V>
+	void parse(std::string_view text, V &visitor);
+
+	template <typename V>
+	void parse_file(const char *path, V &visitor);
+
+	/**
+	 * Read-only view of the bytes of an lnx file.  Regular files are mapped
+	 * into memory with mmap(2) so that the parser can work directly on the
+	 * page cache; anything else (pipes, /dev/stdin, ...) falls back to
+	 * reading the whole input with read(2) into a private buffer.
+	 */
+	class MappedFile {
+	public:
+	    MappedFile(const char *path);
+	    ~MappedFile();
+
+	    MappedFile(const MappedFile &) = delete;
+	    MappedFile &operator=(const MappedFile &) = delete;
+
+	    /**
+	     * False if the file could not be opened or read, in which case
+	     * errno describes the failure.
+	     */
+	    bool ok() const { return m_ok; }
+	    const char *data() const { return m_data; }
+	    size_t size() const { return m_size; }
+
+	private:
+	    const char *m_data;
+	    size_t m_size;
+	    bool m_mapped;
+	    bool m_ok;
+	    std::vector<char> m_buf;
+	};
+
+	namespace detail {
+		/**
+		 * Every keyword that can appear in an lnx file, either as a
+		 * directive or as the second word of a `rip`/`tcp` directive.
+		 */
+		enum class Keyword {
+			UNKNOWN,
+			INTERFACE,
+			NEIGHBOR,
+			ROUTING,
+			ROUTE,
+			RIP,
+			TCP,
+			PERIODIC_UPDATE_RATE,
+			ROUTE_TIMEOUT_THRESHOLD,
+			ADVERTISE_TO,
+			RTO_MIN,
+			RTO_MAX,
+		};
+
+		/**
+		 * Map a word to its keyword.  The switch on length and first
+		 * character leaves at most one candidate per keyword, so each
+		 * lookup is a jump plus a single memcmp.
+		 */
+		constexpr Keyword lookup_keyword(std::string_view w) {
+			switch (w.size()) {
+			case 3:
+				if (w == "rip") return Keyword::RIP;
+				if (w == "tcp") return Keyword::TCP;
+				break;
+			case 5:
+				if (w == "route") return Keyword::ROUTE;
+				break;
+			case 7:
+				if (w[0] == 'r') {
+					if (w == "routing") return Keyword::ROUTING;
+					if (w == "rto-min") return Keyword::RTO_MIN;
+					if (w == "rto-max") return Keyword::RTO_MAX;
+				}
+				break;
+			case 8:
+				if (w == "neighbor") return Keyword::NEIGHBOR;
+				break;
+			case 9:
+				if (w == "interface") return Keyword::INTERFACE;
+				break;
+			case 12:
+				if (w == "advertise-to") return Keyword::ADVERTISE_TO;
+				break;
+			case 20:
+				if (w == "periodic-update-rate") return Keyword::PERIODIC_UPDATE_RATE;
+				break;
+			case 23:
+				if (w == "route-timeout-threshold") return Keyword::ROUTE_TIMEOUT_THRESHOLD;
+				break;
+			}
+			return Keyword::UNKNOWN;
+		}
+
+		/**
+		 * SWAR step for one decimal octet: classify the 8 bytes at `p` at
+		 * once to find the length of the leading run of digits, then
+		 * combine up to three digits with a single multiply (each digit
+		 * sits in its own 16-bit lane, and the weights for the run length
+		 * make lane 2 of the product their decimal value).
+		 *
+		 * Returns the length of the digit run (0 if `p` does not start
+		 * with a digit) and, if it is at most 3, stores its value in
+		 * `out`.  Requires 8 readable bytes at `p`.
+		 */
+		inline unsigned swar_octet(const char *p, uint32_t &out) {
+			static constexpr uint64_t weights[4] = {
+				0,
+				1ULL << 32,
+				(10ULL << 32) | (1ULL << 16),
+				(100ULL << 32) | (10ULL << 16) | 1,
+			};
+
+			uint64_t w;
+			std::memcpy(&w, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			w = __builtin_bswap64(w);
+#endif
+			// '0'..'9' become 0..9, and nothing else maps below 10
+			uint64_t t = w ^ 0x3030303030303030ULL;
+			uint64_t nondigit = (((t & 0x7f7f7f7f7f7f7f7fULL) + 0x7676767676767676ULL) | t) &
+				0x8080808080808080ULL;
+			unsigned len = nondigit ? (unsigned) __builtin_ctzll(nondigit) >> 3 : 8;
+
+			uint64_t lanes = (t & 0xff) | ((t & 0xff00) << 8) | ((t & 0xff0000) << 16);
+			out = (uint32_t) (((lanes * weights[len < 4 ? len : 0]) >> 32) & 0xffff);
+			return len;
+		}
+
+		static_assert(lookup_keyword("interface") == Keyword::INTERFACE, "");
+		static_assert(lookup_keyword("rto-max") == Keyword::RTO_MAX, "");
+		static_assert(lookup_keyword("ripx") == Keyword::UNKNOWN, "");
+
+		/**
+		 * Character classes used by LineScanner, so that each byte of a
+		 * token costs one table lookup instead of a chain of compares.
+		 */
+		enum : uint8_t {
+			CC_SPACE = 1,  // Separates tokens
+			CC_END = 2,    // Ends any token: space or '#'
+			CC_ADDR = 4,   // Ends an address: CC_END, '/' or ':'
+			CC_DIGIT = 8,
+		};
+
+		struct CharClasses {
+			uint8_t c[256];
+		};
+
+		constexpr CharClasses make_char_classes() {
+			CharClasses t = {};
+			for (const char *sp = " \t\r\v\f"; *sp; sp++) {
+				t.c[(uint8_t) *sp] = CC_SPACE | CC_END | CC_ADDR;
+			}
+			t.c[(uint8_t) '#'] = CC_END | CC_ADDR;
+			t.c[(uint8_t) '/'] = CC_ADDR;
+			t.c[(uint8_t) ':'] = CC_ADDR;
+			for (char d = '0'; d <= '9'; d++) {
+				t.c[(uint8_t) d] = CC_DIGIT;
+			}
+			return t;
+		}
+
+		inline constexpr CharClasses char_classes = make_char_classes();
+
+		// htonl, usable in constant expressions
+		constexpr uint32_t host_to_net(uint32_t x) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			return x;
+#else
+			return __builtin_bswap32(x);
+#endif
+		}
+
+		// End of the line starting at p: the next '\n', or `end`
+		constexpr const char *find_eol(const char *p, const char *end) {
+			if (!__builtin_is_constant_evaluated()) {
+				const char *eol = (const char *) std::memchr(p, '\n', end - p);
+				return eol ? eol : end;
+			}
+			while (p < end && *p != '\n') {
+				p++;
+			}
+			return p;
+		}
+
+		/**
+		 * Single-pass cursor over one line of an lnx file.  Words are
+		 * separated by whitespace, and a '#' ends the line (comment).
+		 * Each method skips leading whitespace, consumes one token and
+		 * returns false if the token is missing or malformed; error()
+		 * then describes the first failure.
+		 *
+		 * `limit` is the end of the whole input buffer, which may be past
+		 * the end of the line.  Address parsing reads ahead in 8-byte
+		 * words when that many bytes are available before `limit`.
+		 */
+		class LineScanner {
+		public:
+		    LNX_PARSE_CONSTEXPR LineScanner(const char *begin, const char *end, const char *limit)
+			: m_p(begin), m_end(end), m_limit(limit), m_error(nullptr) {}
+
+		    LNX_PARSE_CONSTEXPR const char *error() const { return m_error ? m_error : MISSING; }
+
+		    // A run of non-space characters, e.g. a keyword or interface name
+		    LNX_PARSE_CONSTEXPR bool word(std::string_view &out) {
+			skip_space();
+			const char *start = m_p;
+			while (m_p < m_end && !is(*m_p, CC_END)) {
+				m_p++;
+			}
+			out = std::string_view(start, m_p - start);
+			return m_p != start || fail(MISSING);
+		    }
+
+		    // A dotted-quad address: four octets <= 255, no leading zeros
+		    LNX_PARSE_CONSTEXPR bool ipv4(in_addr &out) {
+			LNX_STATS_TIME(addr_cycles);
+			skip_space();
+			if (m_p == m_end || is(*m_p, CC_END)) {
+				return fail(MISSING);
+			}
+
+			uint32_t addr = 0;
+			for (int i = 0; i < 4; i++) {
+				if (i > 0) {
+					if (m_p == m_end || *m_p != '.') {
+						return fail(BAD_ADDR);
+					}
+					m_p++;
+				}
+
+				uint32_t v = 0;
+				unsigned len = 0;
+				bool wide = m_limit - m_p >= 8 && !__builtin_is_constant_evaluated();
+				if (wide) {
+					len = swar_octet(m_p, v);
+				}
+				if (!wide || m_p + len > m_end) {
+					// Near the end of the buffer, or the run
+					// crossed the end of the line
+					len = 0;
+					v = 0;
+					while (m_p + len < m_end && len < 4 && is(m_p[len], CC_DIGIT)) {
+						v = v * 10 + (uint32_t) (m_p[len] - '0');
+						len++;
+					}
+				}
+				if (len == 0 || len > 3 || v > 255 || (len > 1 && *m_p == '0')) {
+					return fail(BAD_ADDR);
+				}
+				m_p += len;
+				addr = (addr << 8) | v;
+			}
+
+			if (m_p < m_end && !is(*m_p, CC_ADDR)) {
+				return fail(BAD_ADDR);
+			}
+			out.s_addr = host_to_net(addr);
+			return true;
+		    }
+
+		    // <addr>/<prefix_len>, with prefix_len <= 32
+		    LNX_PARSE_CONSTEXPR bool prefix(in_addr &addr, int &len) {
+			uint64_t v;
+			if (!ipv4(addr)) {
+				return false;
+			}
+			if (!expect('/')) {
+				return fail(MISSING);
+			}
+			if (!digits(v) || v > 32 || !at_boundary()) {
+				return fail(BAD_PREFIX);
+			}
+			len = (int) v;
+			return true;
+		    }
+
+		    // <addr>:<port>, with port <= 65535
+		    LNX_PARSE_CONSTEXPR bool endpoint(in_addr &addr, uint16_t &port) {
+			uint64_t v;
+			if (!ipv4(addr)) {
+				return false;
+			}
+			if (!expect(':')) {
+				return fail(MISSING);
+			}
+			if (!digits(v) || v > 65535 || !at_boundary()) {
+				return fail(BAD_PORT);
+			}
+			port = (uint16_t) v;
+			return true;
+		    }
+
+		    // An unsigned decimal number
+		    LNX_PARSE_CONSTEXPR bool number(uint64_t &out) {
+			skip_space();
+			if (m_p == m_end || !is(*m_p, CC_DIGIT)) {
+				return fail(MISSING);
+			}
+			return digits(out) || fail(BAD_NUMBER);
+		    }
+
+		    // A fixed word such as "at" or "via"
+		    LNX_PARSE_CONSTEXPR bool literal(std::string_view lit) {
+			std::string_view w;
+			return (word(w) && w == lit) || fail(MISSING);
+		    }
+
+		private:
+		    static constexpr const char *MISSING = "Did not find enough tokens";
+		    static constexpr const char *BAD_ADDR = "Failed to parse IP address";
+		    static constexpr const char *BAD_PREFIX = "Invalid prefix length";
+		    static constexpr const char *BAD_PORT = "Invalid port number";
+		    static constexpr const char *BAD_NUMBER = "Number out of range";
+
+		    static constexpr bool is(char c, uint8_t cls) {
+			return (char_classes.c[(uint8_t) c] & cls) != 0;
+		    }
+
+		    LNX_PARSE_CONSTEXPR bool fail(const char *msg) {
+			if (m_error == nullptr) {
+				m_error = msg;
+			}
+			return false;
+		    }
+
+		    LNX_PARSE_CONSTEXPR void skip_space() {
+			while (m_p < m_end && is(*m_p, CC_SPACE)) {
+				m_p++;
+			}
+		    }
+
+		    LNX_PARSE_CONSTEXPR bool at_boundary() const {
+			return m_p == m_end || is(*m_p, CC_END);
+		    }
+
+		    // A separator character immediately following the previous token
+		    LNX_PARSE_CONSTEXPR bool expect(char c) {
+			if (m_p < m_end && *m_p == c) {
+				m_p++;
+				return true;
+			}
+			return false;
+		    }
+
+		    // Digits at the cursor, false if none or on overflow
+		    LNX_PARSE_CONSTEXPR bool digits(uint64_t &out) {
+			const char *start = m_p;
+			uint64_t v = 0;
+			bool overflow = false;
+			while (m_p < m_end && is(*m_p, CC_DIGIT)) {
+				uint64_t d = (uint64_t) (*m_p - '0');
+				if (v > (UINT64_MAX - d) / 10) {
+					overflow = true;
+				}
+				v = v * 10 + d;
+				m_p++;
+			}
+			out = v;
+			return m_p != start && !overflow;
+		    }
+
+		    const char *m_p;
+		    const char *m_end;
+		    const char *m_limit;
+		    const char *m_error;
+		};
+
+		LNX_PARSE_CONSTEXPR bool fail(ParseError &err, const char *msg, int lineno);
+		[[noreturn]] void die(const ParseError &err);
+
+		template <typename V>
+		LNX_PARSE_CONSTEXPR bool parse_line(const char *begin, const char *end, const char *limit, int lineno,
+				V &visitor, ParseError &err);
+	}
+
+	namespace detail {
+		/*
+		 * Binary snapshot format (see Config::save_snapshot).  A snapshot
+		 * is a SnapshotHeader followed by flat arrays of
+		 *   SnapshotInterface[n_interfaces]
+		 *   SnapshotNeighbor[n_neighbors]
+		 *   StaticRoute[n_static_routes]
+		 *   RIPNeighbor[n_rip_neighbors]
+		 * and finally a string table holding each distinct interface name
+		 * once.  All fields are in host byte order (addresses stay in
+		 * network order, as in in_addr), so snapshots are only meant to
+		 * be read back on the machine that wrote them.
+		 */
+		constexpr char SNAPSHOT_MAGIC[8] = {'L', 'N', 'X', 'S', 'N', 'A', 'P', '\0'};
+		constexpr uint32_t SNAPSHOT_VERSION = 1;
+		constexpr uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+		/**
+		 * Identifies the lnx file a snapshot was built from
+		 */
+		struct SnapshotSource {
+			uint64_t size;
+			int64_t mtime_ns;
+			uint64_t hash;
+		};
+
+		struct SnapshotHeader {
+			char magic[8];
+			uint32_t version;
+			uint32_t byte_order;
+			SnapshotSource source;
+
+			uint32_t routing_mode;
+			uint32_t n_interfaces;
+			uint32_t n_neighbors;
+			uint32_t n_static_routes;
+			uint32_t n_rip_neighbors;
+			uint32_t strtab_size;
+
+			uint64_t rip_periodic_update_rate_ms;
+			uint64_t rip_timeout_threshold_ms;
+			uint64_t tcp_rto_min_us;
+			uint64_t tcp_rto_max_us;
+		};
+
+		struct SnapshotInterface {
+			uint32_t name_off;
+			uint32_t name_len;
+			in_addr assigned_ip;
+			int32_t prefix_len;
+			in_addr udp_addr;
+			uint16_t udp_port;
+			uint16_t pad;
+		};
+
+		struct SnapshotNeighbor {
+			in_addr dest_addr;
+			in_addr udp_addr;
+			uint16_t udp_port;
+			uint16_t pad;
+			uint32_t ifname_off;
+			uint32_t ifname_len;
+		};
+
+		static_assert(sizeof(SnapshotHeader) == 96, "snapshot header layout changed");
+		static_assert(sizeof(SnapshotInterface) == 24, "snapshot layout changed");
+		static_assert(sizeof(SnapshotNeighbor) == 20, "snapshot layout changed");
+		static_assert(sizeof(StaticRoute) == 12 && sizeof(RIPNeighbor) == 4,
+			      "StaticRoute/RIPNeighbor are stored raw in snapshots");
+
+		/**
+		 * Fast non-cryptographic 64-bit hash, used to notice when an lnx
+		 * file's content has changed under an unchanged mtime
+		 */
+		uint64_t hash_bytes(const char *p, size_t n);
+
+		/**
+		 * Fill in size and mtime of `path` (hash is left as 0)
+		 */
+		bool stat_source(const char *path, SnapshotSource &src, ParseError &err);
+
+		/**
+		 * Check that the `size` bytes at `data` are a whole snapshot,
+		 * with every name within its string table, and copy out its
+		 * header.  `data` must be aligned for SnapshotHeader.
+		 */
+		bool check_snapshot(const char *data, size_t size, SnapshotHeader &h, ParseError &err);
+	}
+
+	namespace detail {
+		inline uint32_t hash_u32(uint32_t x) {
+			x *= 0x9e3779b1u;
+			return x ^ (x >> 15);
+		}
+
+		inline uint32_t hash_str(std::string_view s) {
+			uint32_t h = 2166136261u; // FNV-1a
+			for (char c : s) {
+				h = (h ^ (uint8_t) c) * 16777619u;
+			}
+			return h;
+		}
+
+		inline uint64_t endpoint_key(in_addr addr, uint16_t port) {
+			return ((uint64_t) addr.s_addr << 16) | port;
+		}
+
+		inline uint32_t hash_u64(uint64_t x) {
+			return hash_u32((uint32_t) x ^ hash_u32((uint32_t) (x >> 32)));
+		}
+
+		inline std::string endpoint_str(in_addr addr, uint16_t port) {
+			char buf[INET_ADDRSTRLEN];
+			inet_ntop(AF_INET, &addr, buf, sizeof(buf));
+			return std::string(buf) + ":" + std::to_string(port);
+		}
+
+		inline std::string addr_str(in_addr addr) {
+			char buf[INET_ADDRSTRLEN];
+			inet_ntop(AF_INET, &addr, buf, sizeof(buf));
+			return buf;
+		}
+
+		/**
+		 * Open-addressing (linear probing) hash index from some key to
+		 * a position in a vector.  Slots only hold the key's hash and
+		 * the position; the caller supplies the equality check against
+		 * the element at a position, so one index type serves both
+		 * address and name keys without copying the keys.
+		 */
+		class FlatIndex {
+		public:
+		    static constexpr uint32_t NONE = UINT32_MAX;
+
+		    /**
+		     * Clear the index and size it for `n` keys
+		     */
+		    void reset(size_t n) {
+			size_t cap = 8;
+			while (cap < 2 * n) {
+				cap <<= 1;
+			}
+			m_slots.assign(cap, Slot{0, NONE});
+			m_mask = (uint32_t) (cap - 1);
+		    }
+
+		    template <typename Eq>
+		    uint32_t find(uint32_t hash, Eq eq) const {
+			if (m_slots.empty()) {
+				return NONE;
+			}
+			for (uint32_t i = hash & m_mask;; i = (i + 1) & m_mask) {
+				const Slot &s = m_slots[i];
+				if (s.pos == NONE) {
+					return NONE;
+				}
+				if (s.hash == hash && eq(s.pos)) {
+					return s.pos;
+				}
+			}
+		    }
+
+		    /**
+		     * Add `pos` under `hash`, unless an equal key is already
+		     * present (the first one wins).  Returns false in that case.
+		     */
+		    template <typename Eq>
+		    bool insert(uint32_t hash, uint32_t pos, Eq eq) {
+			for (uint32_t i = hash & m_mask;; i = (i + 1) & m_mask) {
+				Slot &s = m_slots[i];
+				if (s.pos == NONE) {
+					s = Slot{hash, pos};
+					return true;
+				}
+				if (s.hash == hash && eq(s.pos)) {
+					return false;
+				}
+			}
+		    }
+
+		    size_t memory() const { return m_slots.capacity() * sizeof(Slot); }
+
+		private:
+		    struct Slot {
+			uint32_t hash;
+			uint32_t pos;
+		    };
+
+		    std::vector<Slot> m_slots;
+		    uint32_t m_mask = 0;
+		};
+	}
+
+	/**
+	 * Structure-of-arrays copy of Config::interfaces(), for code that
+	 * scans one field across all interfaces (e.g. with SIMD compares).
+	 * Addresses and masks are in network byte order, like in_addr, so
+	 * they can be compared against packet headers directly.
+	 *
+	 * Every array is padded with dummy lanes up to a multiple of
+	 * LNX_SOA_LANES, so vector loops need no scalar tail.  Padding lanes
+	 * have network = 0xffffffff and netmask = 0, which no address
+	 * matches; for any other field, ignore lanes at or past `size`.
+	 */
+	struct InterfaceArrays {
+		size_t size;
+		std::vector<uint32_t> assigned_ip;
+		std::vector<uint32_t> network; // assigned_ip & netmask
+		std::vector<uint32_t> netmask;
+		std::vector<uint32_t> udp_addr;
+		std::vector<uint16_t> udp_port; // host byte order
+		std::vector<uint32_t> name;     // index into ConfigArrays::names
+	};
+
+	/**
+	 * Structure-of-arrays copy of Config::neighbors(), padded like
+	 * InterfaceArrays (padding lanes are all zero).
+	 */
+	struct NeighborArrays {
+		size_t size;
+		std::vector<uint32_t> dest_addr;
+		std::vector<uint32_t> udp_addr;
+		std::vector<uint16_t> udp_port; // host byte order
+		std::vector<int32_t> ifindex;   // as in Neighbor::ifindex
+		std::vector<uint32_t> ifname;   // index into ConfigArrays::names
+	};
+
+	struct ConfigArrays {
+		InterfaceArrays interfaces;
+		NeighborArrays neighbors;
+
+		/**
+		 * Each distinct interface name once.  Interfaces come first, so
+		 * for a file without duplicate names, interface i's name is
+		 * names[i].
+		 */
+		std::vector<std::string> names;
+	};
+
+	/**
+	 * A contiguous run of indices into one of Config's vectors
+	 */
+	struct IndexRange {
+		const uint32_t *first;
+		const uint32_t *last;
+
+		const uint32_t *begin() const { return first; }
+		const uint32_t *end() const { return last; }
+		size_t size() const { return last - first; }
+		bool empty() const { return first == last; }
+	};
+
 	class Config {
 	public:
-	    Config(char *path_to_lnx_file);
+	    /**
+	     * Parse the lnx file at `path_to_lnx_file`.  On any error, prints
+	     * a message and exits the process.
+	     */
+	    Config(const char *path_to_lnx_file);
+
+	    /**
+	     * Parse an lnx file that is already in memory.  Never exits: on
+	     * error, returns std::nullopt and describes the first bad line in
+	     * `err`.  Useful for validating many configs in one process.
+	     */
+	    static std::optional<Config> from_string(std::string_view text, ParseError &err);
+
+	    /**
+	     * Same as from_string, reading the file at `path`.
+	     */
+	    static std::optional<Config> from_file(const char *path, ParseError &err);
+
+	    /**
+	     * Write this config to `path` as a compact binary snapshot (see
+	     * detail::SnapshotHeader), replacing any existing file atomically.
+	     */
+	    bool save_snapshot(const char *path, ParseError &err) const;
+
+	    /**
+	     * Load a snapshot written by save_snapshot.  The file is mapped and
+	     * its header and bounds are checked, then the record arrays are
+	     * copied out as-is; no text is parsed.
+	     */
+	    static std::optional<Config> load_snapshot(const char *path, ParseError &err);
+
+	    /**
+	     * Load `lnx_path`, using `snapshot_path` as a cache.  The snapshot
+	     * is used if it was built from a file with the same size and mtime,
+	     * or failing that the same content hash.  Otherwise the lnx file is
+	     * parsed and the snapshot rebuilt.  Failing to write the snapshot
+	     * is not an error, since the config itself was loaded.
+	     */
+	    static std::optional<Config> load_cached(const char *lnx_path, const char *snapshot_path,
+						     ParseError &err);
+
+	    const RoutingMode &routing_mode() const { return m_routing_mode; }
+	    const std::vector<Interface> &interfaces() const { return m_interfaces; }
+	    const std::vector<Neighbor> &neighbors() const { return m_neighbors; }
+	    const std::vector<RIPNeighbor> &rip_neighbors() const { return m_rip_neighbors; }
+	    const std::vector<StaticRoute> &static_routes() const { return m_static_routes; }
+
+	    /**
+	     * Index of the interface called `name` in interfaces(), or -1.
+	     */
+	    int interface_index(std::string_view name) const;
 
-	    const RoutingMode &routing_mode() { return m_routing_mode; }
-	    const std::vector<Interface> &interfaces() { return m_interfaces; }
-	    const std::vector<Neighbor> &neighbors() { return m_neighbors; }
-	    const std::vector<RIPNeighbor> &rip_neighbors() { return m_rip_neighbors; }
-	    const std::vector<StaticRoute> &static_routes() { return m_static_routes; }
+	    /**
+	     * The interface called `name`, or nullptr.
+	     */
+	    const Interface *find_interface(std::string_view name) const;
 
-	    const uint64_t rip_periodic_update_rate() { return m_rip_periodic_update_rate_ms; }
-	    const uint64_t rip_timeout_threshold() { return m_rip_timeout_threshold_ms; }
-	    const uint64_t tcp_rto_min() { return m_tcp_rto_min_us; }
-	    const uint64_t tcp_rto_max() { return m_tcp_rto_max_us; }
+	    /**
+	     * The neighbor with IP `dest_addr`, or nullptr.  If several
+	     * neighbor lines share an address, the first one is returned.
+	     */
+	    const Neighbor *find_neighbor(in_addr dest_addr) const;
+
+	    /**
+	     * Neighbors reachable over interface `ifindex`, as indices into
+	     * neighbors(), in file order.
+	     */
+	    IndexRange neighbors_on(int ifindex) const;
+
+	    /**
+	     * Build a structure-of-arrays copy of interfaces() and neighbors().
+	     * This is not kept by Config, so call it once and hold on to it.
+	     */
+	    ConfigArrays arrays() const;
+
+	    /**
+	     * Check that the config makes sense as a whole, beyond each line
+	     * parsing on its own:
+	     *  - interface names are unique
+	     *  - every neighbor's `via` interface exists
+	     *  - every `rip advertise-to` address is a neighbor
+	     *  - no two interfaces bind the same UDP address and port
+	     *  - no two interface prefixes overlap
+	     * Returns false and describes the first problem in `err` (with
+	     * lineno 0, since these are not about a single line).  Takes time
+	     * linear in the size of the config.
+	     */
+	    bool validate(ParseError &err) const;
+
+	    /**
+	     * How the parse that built this config went (see ParseStats).
+	     * All zero unless built with LNX_STATS=1.
+	     */
+	    const ParseStats &stats() const { return m_stats; }
+
+	    const uint64_t rip_periodic_update_rate() const { return m_rip_periodic_update_rate_ms; }
+	    const uint64_t rip_timeout_threshold() const { return m_rip_timeout_threshold_ms; }
+	    const uint64_t tcp_rto_min() const { return m_tcp_rto_min_us; }
+	    const uint64_t tcp_rto_max() const { return m_tcp_rto_max_us; }
 
 	private:
+	    struct Builder;
+
+	    // Builds a Config as its text arrives (lnxstream.h)
+	    friend class ConfigStream;
+
+	    // Parses one file in chunks and merges them (lnxload.h)
+	    friend std::optional<Config> load_parallel(const char *path, ParseError &err,
+						       unsigned threads);
+
+	    // Published to and read from shared memory (lnxshm.h)
+	    friend class SharedConfigs;
+	    friend class SharedConfig;
+
+	    // Decodes each kind of directive on first use (lnxlazy.h)
+	    friend class LazyConfig;
+
+	    Config();
+
+	    // Called once all directives are in, to resolve names and build
+	    // the lookup indexes below
+	    void finish();
+
+	    bool write_snapshot(const char *path, const detail::SnapshotSource &src,
+				ParseError &err) const;
+	    static std::optional<Config> read_snapshot(const char *path, detail::SnapshotSource *src,
+						       ParseError &err);
+
+	    // The snapshot image itself, without the file around it
+	    std::string encode_snapshot(const detail::SnapshotSource &src) const;
+	    static std::optional<Config> decode_snapshot(const char *data, size_t size,
+							 detail::SnapshotSource *src, ParseError &err);
+
 	    RoutingMode m_routing_mode;
-	    void do_parse_error(std::string msg, int lineno);
-	    void parse_addr(char *ip_str, in_addr *addr, int lineno);
 	    std::vector<Interface> m_interfaces;
 	    std::vector<Neighbor> m_neighbors;
 	    std::vector<RIPNeighbor> m_rip_neighbors;
@@ -168,6 +1207,14 @@ namespace lnx {
 	    // TCP timing parameters (hosts only)
 	    uint64_t m_tcp_rto_min_us;
 	    uint64_t m_tcp_rto_max_us;
+
+	    // Lookup indexes, built by finish()
+	    detail::FlatIndex m_interface_by_name;
+	    detail::FlatIndex m_neighbor_by_addr;
+	    std::vector<uint32_t> m_if_neighbor_start; // CSR offsets, one per interface + 1
+	    std::vector<uint32_t> m_if_neighbor_list;
+
+	    ParseStats m_stats;
 	};
 }
 
@@ -177,166 +1224,937 @@ namespace lnx {
 #define DEFAULT_TCP_RTO_MIN_US 1000
 #define DEFAULT_TCP_RTO_MAX_US 5000000
 
-#define TOKEN_MAX_INTERFACE 5
-#define TOKEN_MAX_NEIGHBOR 4
-#define TOKEN_MAX_RIP_NEIGHBOR 1
-#define TOKEN_MAX_ROUTE 3
-#define TOKEN_MAX_NAME 64
-#define TOKEN_MAX_NUMBER 1
 
-#define LNX_IFNAME_MAX 64
+inline lnx::MappedFile::MappedFile(const char *path)
+	: m_data(nullptr), m_size(0), m_mapped(false), m_ok(false) {
+	LNX_STATS_TIME(read_cycles);
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		int saved = errno;
+		close(fd);
+		errno = saved;
+		return;
+	}
+
+	if (S_ISREG(st.st_mode)) {
+		m_size = (size_t) st.st_size;
+		if (m_size > 0) {
+			int flags = MAP_PRIVATE;
+#if LNX_STATS && defined(MAP_POPULATE)
+			flags |= MAP_POPULATE; // Count the I/O as reading, not parsing
+#endif
+			void *p = mmap(nullptr, m_size, PROT_READ, flags, fd, 0);
+			if (p == MAP_FAILED) {
+				int saved = errno;
+				close(fd);
+				errno = saved;
+				return;
+			}
+			madvise(p, m_size, MADV_SEQUENTIAL);
+			m_data = (const char *) p;
+			m_mapped = true;
+		}
+	} else {
+		// Not mappable, so just slurp it
+		char chunk[65536];
+		ssize_t n;
+		while ((n = read(fd, chunk, sizeof(chunk))) != 0) {
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				int saved = errno;
+				close(fd);
+				errno = saved;
+				return;
+			}
+			m_buf.insert(m_buf.end(), chunk, chunk + n);
+		}
+		m_data = m_buf.data();
+		m_size = m_buf.size();
+	}
+
+	close(fd);
+	m_ok = true;
+}
 
-lnx::Config::Config(char *path_to_lnx_file) {
-	std::ifstream f(path_to_lnx_file);
-	if (!f.is_open()) {
-		std::perror("Failed to open file");
-		std::exit(1);
+inline lnx::MappedFile::~MappedFile() {
+	if (m_mapped) {
+		munmap((void *) m_data, m_size);
 	}
+}
+
+template <typename V>
+LNX_PARSE_CONSTEXPR bool lnx::parse(std::string_view text, V &visitor, ParseError &err) {
+	// Walk the input one line at a time, tokenizing each line in place;
+	// nothing is copied or allocated per line.
+	const char *p = text.data();
+	const char *end = p + text.size();
+	LNX_STATS_TIME(parse_cycles);
+
+	int lineno = 0;
+	while (p < end) {
+		const char *eol = detail::find_eol(p, end);
+
+		lineno++;
+		LNX_STATS_ADD(lines, 1);
+		if (!detail::parse_line(p, eol, end, lineno, visitor, err)) {
+			return false;
+		}
+		p = eol + 1;
+	}
+	return true;
+}
+
+template <typename V>
+bool lnx::parse_file(const char *path, V &visitor, ParseError &err) {
+	MappedFile f(path);
+	if (!f.ok()) {
+		err.lineno = 0;
+		err.msg = std::string("Failed to open file: ") + std::strerror(errno);
+		return false;
+	}
+	LNX_STATS_ADD(bytes_read, f.size());
+	return parse(std::string_view(f.data(), f.size()), visitor, err);
+}
+
+template <typename V>
+void lnx::parse(std::string_view text, V &visitor) {
+	ParseError err;
+	if (!parse(text, visitor, err)) {
+		detail::die(err);
+	}
+}
+
+template <typename V>
+void lnx::parse_file(const char *path, V &visitor) {
+	ParseError err;
+	if (!parse_file(path, visitor, err)) {
+		detail::die(err);
+	}
+}
+
+template <typename V>
+LNX_PARSE_CONSTEXPR bool lnx::detail::parse_line(const char *begin, const char *end, const char *limit, int lineno,
+			      V &visitor, ParseError &err) {
+	LineScanner sc(begin, end, limit);
+	std::string_view keyword;
 
+	if (!sc.word(keyword)) {
+		LNX_STATS_ADD(blank_lines, 1);
+		return true; // Blank or comment-only line
+	}
+
+	switch (lookup_keyword(keyword)) {
+	case Keyword::INTERFACE: {
+		// interface <name> <addr>/<prefix> <udp_addr>:<udp_port>
+		LNX_STATS_ADD(interface_lines, 1);
+		InterfaceView i;
+		if (!(sc.word(i.name) && sc.prefix(i.assigned_ip, i.prefix_len) &&
+		      sc.endpoint(i.udp_addr, i.udp_port))) {
+			return fail(err, sc.error(), lineno);
+		}
+		if (i.name.size() >= LNX_IFNAME_MAX) {
+			return fail(err, "Interface name too long", lineno);
+		}
+		visitor.on_interface(i, lineno);
+		break;
+	}
+	case Keyword::NEIGHBOR: {
+		// neighbor <dest_addr> at <udp_addr>:<udp_port> via <ifname>
+		LNX_STATS_ADD(neighbor_lines, 1);
+		NeighborView n;
+		if (!(sc.ipv4(n.dest_addr) && sc.literal("at") && sc.endpoint(n.udp_addr, n.udp_port) &&
+		      sc.literal("via") && sc.word(n.ifname))) {
+			return fail(err, sc.error(), lineno);
+		}
+		if (n.ifname.size() >= LNX_IFNAME_MAX) {
+			return fail(err, "Interface name too long", lineno);
+		}
+		visitor.on_neighbor(n, lineno);
+		break;
+	}
+	case Keyword::ROUTING: {
+		// routing <rip|static>
+		LNX_STATS_ADD(routing_lines, 1);
+		std::string_view mode;
+		if (!sc.word(mode)) {
+			return fail(err, sc.error(), lineno);
+		}
+		if (mode == "rip") {
+			visitor.on_routing(RoutingMode::RIP, lineno);
+		} else if (mode == "static") {
+			visitor.on_routing(RoutingMode::STATIC, lineno);
+		} else {
+			return fail(err, "Unrecognized routing mode", lineno);
+		}
+		break;
+	}
+	case Keyword::RIP: {
+		LNX_STATS_ADD(rip_lines, 1);
+		RIPDirective r = {};
+		std::string_view sub;
+		if (!sc.word(sub)) {
+			return fail(err, sc.error(), lineno);
+		}
+
+		bool ok;
+		switch (lookup_keyword(sub)) {
+		case Keyword::PERIODIC_UPDATE_RATE:
+			r.kind = RIPDirective::Kind::PERIODIC_UPDATE_RATE;
+			ok = sc.number(r.value_ms);
+			break;
+		case Keyword::ROUTE_TIMEOUT_THRESHOLD:
+			r.kind = RIPDirective::Kind::ROUTE_TIMEOUT_THRESHOLD;
+			ok = sc.number(r.value_ms);
+			break;
+		case Keyword::ADVERTISE_TO:
+			r.kind = RIPDirective::Kind::ADVERTISE_TO;
+			ok = sc.ipv4(r.dest);
+			break;
+		default:
+			return fail(err, "Unexpected RIP directive", lineno);
+		}
+		if (!ok) {
+			return fail(err, sc.error(), lineno);
+		}
+		visitor.on_rip(r, lineno);
+		break;
+	}
+	case Keyword::ROUTE: {
+		// route <network_addr>/<prefix> via <next_hop>
+		LNX_STATS_ADD(route_lines, 1);
+		StaticRoute s;
+		if (!(sc.prefix(s.network_addr, s.prefix_len) && sc.literal("via") &&
+		      sc.ipv4(s.next_hop))) {
+			return fail(err, sc.error(), lineno);
+		}
+		visitor.on_route(s, lineno);
+		break;
+	}
+	case Keyword::TCP: {
+		LNX_STATS_ADD(tcp_lines, 1);
+		TCPDirective t;
+		std::string_view sub;
+		if (!sc.word(sub)) {
+			return fail(err, sc.error(), lineno);
+		}
+
+		switch (lookup_keyword(sub)) {
+		case Keyword::RTO_MIN:
+			t.kind = TCPDirective::Kind::RTO_MIN;
+			break;
+		case Keyword::RTO_MAX:
+			t.kind = TCPDirective::Kind::RTO_MAX;
+			break;
+		default:
+			return fail(err, "Unrecognized TCP directive", lineno);
+		}
+		if (!sc.number(t.value_us)) {
+			return fail(err, sc.error(), lineno);
+		}
+		visitor.on_tcp(t, lineno);
+		break;
+	}
+	default:
+		// Unknown directives are ignored
+		LNX_STATS_ADD(unknown_lines, 1);
+		break;
+	}
+	return true;
+}
+
+LNX_PARSE_CONSTEXPR inline bool lnx::detail::fail(ParseError &err, const char *msg, int lineno) {
+	err.lineno = lineno;
+	err.msg = msg;
+	return false;
+}
+
+inline void lnx::detail::die(const ParseError &err) {
+	if (err.lineno == 0) {
+		std::cerr << err.msg << std::endl;
+	} else {
+		std::cerr << "Parse error, line " << err.lineno << ": " << err.msg << std::endl;
+	}
+	std::exit(1);
+}
+
+/**
+ * The visitor that Config uses to collect every directive into its vectors
+ */
+struct lnx::Config::Builder : public lnx::Visitor {
+	Config &c;
+
+	Builder(Config &config) : c(config) {}
+
+	// push_back, recording any growth in the parse stats
+	template <typename T>
+	static void add(std::vector<T> &v, T &&x) {
+		[[maybe_unused]] size_t cap = v.capacity();
+		v.push_back(std::move(x));
+		LNX_STATS_GROW(cap * sizeof(T), v.capacity() * sizeof(T));
+	}
+
+	// Names too long for the small-string buffer get a heap copy
+	static void add_name(const std::string &name) {
+		if (name.capacity() > std::string().capacity()) {
+			LNX_STATS_GROW(0, name.capacity() + 1);
+		}
+	}
+
+	void on_interface(const InterfaceView &v, int) {
+		LNX_STATS_TIME(build_cycles);
+		Interface i;
+		i.name = v.name;
+		i.assigned_ip = v.assigned_ip;
+		i.prefix_len = v.prefix_len;
+		i.udp_addr = v.udp_addr;
+		i.udp_port = v.udp_port;
+		add_name(i.name);
+		add(c.m_interfaces, std::move(i));
+	}
+
+	void on_neighbor(const NeighborView &v, int) {
+		LNX_STATS_TIME(build_cycles);
+		Neighbor n;
+		n.dest_addr = v.dest_addr;
+		n.udp_addr = v.udp_addr;
+		n.udp_port = v.udp_port;
+		n.ifname = v.ifname;
+		add_name(n.ifname);
+		add(c.m_neighbors, std::move(n));
+	}
+
+	void on_routing(RoutingMode mode, int) {
+		c.m_routing_mode = mode;
+	}
+
+	void on_route(const StaticRoute &s, int) {
+		LNX_STATS_TIME(build_cycles);
+		add(c.m_static_routes, StaticRoute(s));
+	}
+
+	void on_rip(const RIPDirective &r, int) {
+		LNX_STATS_TIME(build_cycles);
+		switch (r.kind) {
+		case RIPDirective::Kind::PERIODIC_UPDATE_RATE:
+			c.m_rip_periodic_update_rate_ms = r.value_ms;
+			break;
+		case RIPDirective::Kind::ROUTE_TIMEOUT_THRESHOLD:
+			c.m_rip_timeout_threshold_ms = r.value_ms;
+			break;
+		case RIPDirective::Kind::ADVERTISE_TO:
+			add(c.m_rip_neighbors, RIPNeighbor{r.dest});
+			break;
+		}
+	}
+
+	void on_tcp(const TCPDirective &t, int) {
+		switch (t.kind) {
+		case TCPDirective::Kind::RTO_MIN:
+			c.m_tcp_rto_min_us = t.value_us;
+			break;
+		case TCPDirective::Kind::RTO_MAX:
+			c.m_tcp_rto_max_us = t.value_us;
+			break;
+		}
+	}
+};
+
+inline lnx::Config::Config() {
 	// Set default constants
 	m_routing_mode = RoutingMode::STATIC;
 	m_rip_periodic_update_rate_ms = DEFAULT_RIP_PERIODIC_UPDATE_RATE_MS;
 	m_rip_timeout_threshold_ms = DEFAULT_RIP_TIMEOUT_THRESHOLD_MS;
 	m_tcp_rto_min_us = DEFAULT_TCP_RTO_MIN_US;
 	m_tcp_rto_max_us = DEFAULT_TCP_RTO_MAX_US;
+}
 
-	std::string line;
-	int tokens;
-	int port;
-	char ip_buf1[LINE_MAX];
-	char ip_buf2[LINE_MAX];
-	char first_token[TOKEN_MAX_NAME];
-	char name[LNX_IFNAME_MAX];
+inline lnx::Config::Config(const char *path_to_lnx_file) : Config() {
+	LNX_STATS_SCOPE(m_stats);
+	Builder b(*this);
+	parse_file(path_to_lnx_file, b);
+	finish();
+}
 
-	int lineno = 0;
-	while (std::getline(f, line)) {
-		lineno++;
+inline std::optional<lnx::Config> lnx::Config::from_string(std::string_view text,
+							    ParseError &err) {
+	Config c;
+	LNX_STATS_SCOPE(c.m_stats);
+	Builder b(c);
+	if (!parse(text, b, err)) {
+		return std::nullopt;
+	}
+	c.finish();
+	return c;
+}
 
-		if (line[0] == '#') {
-			continue;
-		}
-
-		if ((tokens = std::sscanf(line.c_str(), "%10s", first_token)) != 1) {
-			continue;
-		}
-
-		if ((strncmp(first_token, "interface", TOKEN_MAX_NAME)) == 0) {
-			Interface i;
-			tokens = std::sscanf(line.c_str(), "interface %32s %32[^/]/%2d %32[^:]:%d",
-				name, ip_buf1, &i.prefix_len, ip_buf2, &port);
-			if (tokens != TOKEN_MAX_INTERFACE) {
-				do_parse_error("Did not find enough tokens", lineno);
-			}
-			i.name = name;
-			parse_addr(ip_buf1, &i.assigned_ip, lineno);
-			// prefix_len assigned above
-			parse_addr(ip_buf2, &i.udp_addr, lineno);
-			i.udp_port = (uint16_t) port;
-			m_interfaces.push_back(i);
-		} else if ((strncmp(first_token, "neighbor", TOKEN_MAX_NAME)) == 0) {
-			Neighbor n;
-			tokens = sscanf(line.c_str(), "neighbor %32s at %32[^:]:%d via %32[^ #]",
-				ip_buf1, ip_buf2, &port, name);
-			if (tokens != TOKEN_MAX_NEIGHBOR) {
-				do_parse_error("Did not find enough tokens", lineno);
-			}
-			parse_addr(ip_buf1, &n.dest_addr, lineno);
-			parse_addr(ip_buf2, &n.udp_addr, lineno);
-			n.udp_port = (uint16_t) port;
-			n.ifname = name;
-			m_neighbors.push_back(n);
-		} else if ((strncmp(first_token, "routing", TOKEN_MAX_NAME) == 0)) {
-			char *mode_str = ip_buf1; // Reuse this buffer
-			tokens = sscanf(line.c_str(), "routing %32s", mode_str);
-			if (tokens != 1) {
-				do_parse_error("Did not find enough tokens", lineno);
-			}
-			if (strncmp(mode_str, "rip", TOKEN_MAX_NAME) == 0) {
-				m_routing_mode = RoutingMode::RIP;
-			} else if (strncmp(mode_str, "static", TOKEN_MAX_NAME) == 0) {
-				m_routing_mode = RoutingMode::STATIC;
-			} else {
-				do_parse_error("Unrecognized routing mode", lineno);
-			}
-		} else if (strncmp(first_token, "rip", TOKEN_MAX_NAME) == 0) {
-			char second_token[TOKEN_MAX_NAME];
-			memset(second_token, 0, TOKEN_MAX_NAME);
-
-			if ((tokens = sscanf(line.c_str(), "rip %32s", second_token)) != 1) {
-			    do_parse_error("Did not find enough tokens", lineno);
-			}
-
-			if (strncmp(second_token, "periodic-update-rate", TOKEN_MAX_NAME) == 0) {
-			    tokens = sscanf(line.c_str(), "rip periodic-update-rate %lu",
-					    &m_rip_periodic_update_rate_ms);
-			    if (tokens != TOKEN_MAX_NUMBER) {
-				do_parse_error("Did not find enough tokens", lineno);
-			    }
-			} else if (strncmp(second_token, "route-timeout-threshold", TOKEN_MAX_NAME) == 0) {
-			    tokens = sscanf(line.c_str(), "rip route-timeout-threshold %lu",
-					    &m_rip_timeout_threshold_ms);
-			    if (tokens != TOKEN_MAX_NUMBER) {
-				do_parse_error("Did not find enough tokens", lineno);
-			    }
-			} else if (strncmp(second_token, "advertise-to", TOKEN_MAX_NAME) == 0) {
-			    tokens = sscanf(line.c_str(), "rip advertise-to %32s", ip_buf1);
-			    if (tokens != TOKEN_MAX_RIP_NEIGHBOR) {
-				do_parse_error("Did not find enough tokens", lineno);
-			    }
-			    RIPNeighbor r;
-			    parse_addr(ip_buf1, &r.dest, lineno);
-			    m_rip_neighbors.push_back(r);
-			} else {
-			    do_parse_error("Unexpected RIP directive", lineno);
-			}
-		} else if (strncmp(first_token, "route", TOKEN_MAX_NAME) == 0) {
-			StaticRoute s;
-			tokens = sscanf(line.c_str(), "route %32[^/]/%2d via %32s",
-				ip_buf1, &s.prefix_len, ip_buf2);
-			if (tokens != TOKEN_MAX_ROUTE) {
-				do_parse_error("Did not find enough tokens", lineno);
-			}
-			parse_addr(ip_buf1, &s.network_addr, lineno);
-			parse_addr(ip_buf2, &s.next_hop, lineno);
-			m_static_routes.push_back(s);
-		} else if (strncmp(first_token, "tcp", TOKEN_MAX_NAME) == 0) {
-		    char second_token[TOKEN_MAX_NAME];
-		    memset(second_token, 0, TOKEN_MAX_NAME);
-
-		    if ((tokens = sscanf(line.c_str(), "tcp %32s", second_token)) != 1) {
-			do_parse_error("Did not find enough tokens", lineno);
-		    }
+inline std::optional<lnx::Config> lnx::Config::from_file(const char *path, ParseError &err) {
+	Config c;
+	LNX_STATS_SCOPE(c.m_stats);
+	Builder b(c);
+	if (!parse_file(path, b, err)) {
+		return std::nullopt;
+	}
+	c.finish();
+	return c;
+}
 
-		    if (strncmp(second_token, "rto-min", TOKEN_MAX_NAME) == 0) {
-			tokens = sscanf(line.c_str(), "tcp rto-min %lu",
-					&m_tcp_rto_min_us);
-			if (tokens != TOKEN_MAX_NUMBER) {
-			    do_parse_error("Did not find enough tokens", lineno);
+inline void lnx::Config::finish() {
+	LNX_STATS_TIME(index_cycles);
+	m_interface_by_name.reset(m_interfaces.size());
+	for (size_t i = 0; i < m_interfaces.size(); i++) {
+		const std::string &name = m_interfaces[i].name;
+		m_interface_by_name.insert(detail::hash_str(name), (uint32_t) i, [&](uint32_t pos) {
+			return m_interfaces[pos].name == name;
+		});
+	}
+
+	m_neighbor_by_addr.reset(m_neighbors.size());
+	m_if_neighbor_start.assign(m_interfaces.size() + 1, 0);
+	for (size_t i = 0; i < m_neighbors.size(); i++) {
+		Neighbor &n = m_neighbors[i];
+		n.ifindex = interface_index(n.ifname);
+		n.udp_sockaddr.sin_family = AF_INET;
+		n.udp_sockaddr.sin_addr = n.udp_addr;
+		n.udp_sockaddr.sin_port = htons(n.udp_port);
+		if (n.ifindex >= 0) {
+			m_if_neighbor_start[n.ifindex + 1]++;
+		}
+
+		uint32_t addr = n.dest_addr.s_addr;
+		m_neighbor_by_addr.insert(detail::hash_u32(addr), (uint32_t) i, [&](uint32_t pos) {
+			return m_neighbors[pos].dest_addr.s_addr == addr;
+		});
+	}
+
+	// Counting sort of neighbors by interface
+	for (size_t i = 0; i < m_interfaces.size(); i++) {
+		m_if_neighbor_start[i + 1] += m_if_neighbor_start[i];
+	}
+	m_if_neighbor_list.resize(m_if_neighbor_start.back());
+	std::vector<uint32_t> next(m_if_neighbor_start.begin(), m_if_neighbor_start.end() - 1);
+	for (size_t i = 0; i < m_neighbors.size(); i++) {
+		int ifindex = m_neighbors[i].ifindex;
+		if (ifindex >= 0) {
+			m_if_neighbor_list[next[ifindex]++] = (uint32_t) i;
+		}
+	}
+
+	LNX_STATS_GROW(0, m_interface_by_name.memory());
+	LNX_STATS_GROW(0, m_neighbor_by_addr.memory());
+	LNX_STATS_GROW(0, m_if_neighbor_start.capacity() * sizeof(uint32_t));
+	LNX_STATS_GROW(0, m_if_neighbor_list.capacity() * sizeof(uint32_t));
+	if (m_stats.enabled) {
+		m_stats.tokenize_cycles = m_stats.parse_cycles - m_stats.addr_cycles - m_stats.build_cycles;
+	}
+}
+
+inline int lnx::Config::interface_index(std::string_view name) const {
+	uint32_t pos = m_interface_by_name.find(detail::hash_str(name), [&](uint32_t p) {
+		return m_interfaces[p].name == name;
+	});
+	return pos == detail::FlatIndex::NONE ? -1 : (int) pos;
+}
+
+inline const lnx::Interface *lnx::Config::find_interface(std::string_view name) const {
+	int i = interface_index(name);
+	return i < 0 ? nullptr : &m_interfaces[i];
+}
+
+inline const lnx::Neighbor *lnx::Config::find_neighbor(in_addr dest_addr) const {
+	uint32_t addr = dest_addr.s_addr;
+	uint32_t pos = m_neighbor_by_addr.find(detail::hash_u32(addr), [&](uint32_t p) {
+		return m_neighbors[p].dest_addr.s_addr == addr;
+	});
+	return pos == detail::FlatIndex::NONE ? nullptr : &m_neighbors[pos];
+}
+
+inline lnx::IndexRange lnx::Config::neighbors_on(int ifindex) const {
+	if (ifindex < 0 || (size_t) ifindex >= m_interfaces.size()) {
+		return IndexRange{nullptr, nullptr};
+	}
+	const uint32_t *base = m_if_neighbor_list.data();
+	return IndexRange{base + m_if_neighbor_start[ifindex], base + m_if_neighbor_start[ifindex + 1]};
+}
+
+inline lnx::ConfigArrays lnx::Config::arrays() const {
+	ConfigArrays a;
+	std::unordered_map<std::string_view, uint32_t> name_ids;
+	auto intern = [&](const std::string &name) -> uint32_t {
+		auto it = name_ids.find(name);
+		if (it != name_ids.end()) {
+			return it->second;
+		}
+		uint32_t id = (uint32_t) a.names.size();
+		a.names.push_back(name);
+		name_ids.emplace(name, id);
+		return id;
+	};
+	auto padded = [](size_t n) {
+		return (n + LNX_SOA_LANES - 1) / LNX_SOA_LANES * LNX_SOA_LANES;
+	};
+
+	InterfaceArrays &ia = a.interfaces;
+	size_t ni = padded(m_interfaces.size());
+	ia.size = m_interfaces.size();
+	ia.assigned_ip.assign(ni, 0);
+	ia.network.assign(ni, 0xffffffff);
+	ia.netmask.assign(ni, 0);
+	ia.udp_addr.assign(ni, 0);
+	ia.udp_port.assign(ni, 0);
+	ia.name.assign(ni, 0);
+	for (size_t i = 0; i < m_interfaces.size(); i++) {
+		const Interface &iface = m_interfaces[i];
+		int len = iface.prefix_len;
+		uint32_t mask = len <= 0 ? 0 : len >= 32 ? ~0u : ~0u << (32 - len);
+		ia.assigned_ip[i] = iface.assigned_ip.s_addr;
+		ia.netmask[i] = htonl(mask);
+		ia.network[i] = iface.assigned_ip.s_addr & htonl(mask);
+		ia.udp_addr[i] = iface.udp_addr.s_addr;
+		ia.udp_port[i] = iface.udp_port;
+		ia.name[i] = intern(iface.name);
+	}
+
+	NeighborArrays &na = a.neighbors;
+	size_t nn = padded(m_neighbors.size());
+	na.size = m_neighbors.size();
+	na.dest_addr.assign(nn, 0);
+	na.udp_addr.assign(nn, 0);
+	na.udp_port.assign(nn, 0);
+	na.ifindex.assign(nn, 0);
+	na.ifname.assign(nn, 0);
+	for (size_t i = 0; i < m_neighbors.size(); i++) {
+		const Neighbor &n = m_neighbors[i];
+		na.dest_addr[i] = n.dest_addr.s_addr;
+		na.udp_addr[i] = n.udp_addr.s_addr;
+		na.udp_port[i] = n.udp_port;
+		na.ifindex[i] = n.ifindex;
+		na.ifname[i] = intern(n.ifname);
+	}
+
+	return a;
+}
+
+inline bool lnx::Config::validate(ParseError &err) const {
+	auto invalid = [&](std::string msg) {
+		err = {0, std::move(msg)};
+		return false;
+	};
+
+	// finish() already indexed names and neighbor addresses, with the
+	// first of any duplicates winning
+	for (size_t i = 0; i < m_interfaces.size(); i++) {
+		if (interface_index(m_interfaces[i].name) != (int) i) {
+			return invalid("Duplicate interface name " + m_interfaces[i].name);
+		}
+	}
+	for (const Neighbor &n : m_neighbors) {
+		if (n.ifindex < 0) {
+			return invalid("Neighbor " + detail::addr_str(n.dest_addr) +
+				" is via unknown interface " + n.ifname);
+		}
+	}
+	for (const RIPNeighbor &r : m_rip_neighbors) {
+		if (find_neighbor(r.dest) == nullptr) {
+			return invalid("RIP neighbor " + detail::addr_str(r.dest) +
+				" is not a neighbor IP");
+		}
+	}
+
+	detail::FlatIndex seen;
+	seen.reset(m_interfaces.size());
+	for (uint32_t i = 0; i < m_interfaces.size(); i++) {
+		const Interface &iface = m_interfaces[i];
+		uint64_t ep = detail::endpoint_key(iface.udp_addr, iface.udp_port);
+		auto same_ep = [&](uint32_t p) {
+			return detail::endpoint_key(m_interfaces[p].udp_addr, m_interfaces[p].udp_port) == ep;
+		};
+		if (!seen.insert(detail::hash_u64(ep), i, same_ep)) {
+			const Interface &first = m_interfaces[seen.find(detail::hash_u64(ep), same_ep)];
+			return invalid("Interfaces " + first.name + " and " + iface.name +
+				" both bind " + detail::endpoint_str(iface.udp_addr, iface.udp_port));
+		}
+	}
+
+	// Two prefixes overlap iff the longer one, cut to the shorter one's
+	// length, equals it.  So index every interface by (network, length),
+	// then look each one up cut to every length in use that is no longer
+	// than its own: at most 33 probes per interface.
+	auto network = [](const Interface &iface, int len) {
+		uint32_t mask = len <= 0 ? 0 : len >= 32 ? ~0u : ~0u << (32 - len);
+		return ntohl(iface.assigned_ip.s_addr) & mask;
+	};
+	auto prefix_hash = [](uint32_t net, int len) {
+		return detail::hash_u32(net ^ detail::hash_u32((uint32_t) len));
+	};
+	auto prefix_str = [&](const Interface &iface) {
+		in_addr net = {htonl(network(iface, iface.prefix_len))};
+		return iface.name + " (" + detail::addr_str(net) + "/" + std::to_string(iface.prefix_len) + ")";
+	};
+
+	uint64_t lengths = 0; // Bit L set if some interface has prefix length L
+	seen.reset(m_interfaces.size());
+	for (uint32_t i = 0; i < m_interfaces.size(); i++) {
+		const Interface &iface = m_interfaces[i];
+		uint32_t net = network(iface, iface.prefix_len);
+		auto same = [&](uint32_t p) {
+			return m_interfaces[p].prefix_len == iface.prefix_len &&
+			       network(m_interfaces[p], iface.prefix_len) == net;
+		};
+		if (!seen.insert(prefix_hash(net, iface.prefix_len), i, same)) {
+			const Interface &first = m_interfaces[seen.find(prefix_hash(net, iface.prefix_len), same)];
+			return invalid("Interface " + prefix_str(iface) + " overlaps " +
+				prefix_str(first));
+		}
+		lengths |= (uint64_t) 1 << iface.prefix_len;
+	}
+
+	for (const Interface &iface : m_interfaces) {
+		for (int len = 0; len < iface.prefix_len; len++) {
+			if (!(lengths & ((uint64_t) 1 << len))) {
+				continue;
 			}
-		    } else if (strncmp(second_token, "rto-max", TOKEN_MAX_NAME) == 0) {
-			tokens = sscanf(line.c_str(), "tcp rto-max %lu",
-					&m_tcp_rto_max_us);
-			if (tokens != TOKEN_MAX_NUMBER) {
-			    do_parse_error("Did not find enough tokens", lineno);
+			uint32_t net = network(iface, len);
+			uint32_t p = seen.find(prefix_hash(net, len), [&](uint32_t q) {
+				return m_interfaces[q].prefix_len == len && network(m_interfaces[q], len) == net;
+			});
+			if (p != detail::FlatIndex::NONE) {
+				return invalid("Interface " + prefix_str(iface) + " overlaps " +
+					prefix_str(m_interfaces[p]));
 			}
-		    } else {
-			do_parse_error("Unrecognized TCP directive", lineno);
-		    }
 		}
+	}
+	return true;
+}
+
+inline uint64_t lnx::detail::hash_bytes(const char *p, size_t n) {
+	const uint64_t k = 0x9e3779b97f4a7c15ULL;
+	uint64_t h = n * k;
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		uint64_t w;
+		std::memcpy(&w, p + i, 8);
+		h = (h ^ w) * k;
+		h ^= h >> 29;
+	}
+
+	// memcpy needs a valid pointer even for 0 bytes, and `p` may be null
+	// when `n` is 0
+	uint64_t tail = 0;
+	if (i < n) {
+		std::memcpy(&tail, p + i, n - i);
+	}
+	h = (h ^ tail) * k;
+	h ^= h >> 32;
+	return h;
+}
+
+inline bool lnx::detail::stat_source(const char *path, SnapshotSource &src, ParseError &err) {
+	struct stat st;
+	if (stat(path, &st) < 0) {
+		err.lineno = 0;
+		err.msg = std::string("Failed to open file: ") + std::strerror(errno);
+		return false;
+	}
+	src.size = (uint64_t) st.st_size;
+	src.mtime_ns = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	src.hash = 0;
+	return true;
+}
+
+inline bool lnx::detail::check_snapshot(const char *data, size_t size, SnapshotHeader &h,
+					ParseError &err) {
+	err.lineno = 0;
+	err.msg = "Invalid snapshot";
+
+	if (size < sizeof(h)) {
+		return false;
+	}
+	std::memcpy(&h, data, sizeof(h));
+	if (std::memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) != 0 ||
+	    h.byte_order != SNAPSHOT_BYTE_ORDER ||
+	    h.routing_mode > (uint32_t) RoutingMode::RIP) {
+		return false;
+	}
+	if (h.version != SNAPSHOT_VERSION) {
+		err.msg = "Unsupported snapshot version";
+		return false;
+	}
+
+	uint64_t expected = sizeof(h) +
+		(uint64_t) h.n_interfaces * sizeof(SnapshotInterface) +
+		(uint64_t) h.n_neighbors * sizeof(SnapshotNeighbor) +
+		(uint64_t) h.n_static_routes * sizeof(StaticRoute) +
+		(uint64_t) h.n_rip_neighbors * sizeof(RIPNeighbor) +
+		h.strtab_size;
+	if (expected != size) {
+		return false;
+	}
+
+	// Hold a snapshot to what the text parser accepts, since nothing
+	// downstream checks these again
+	auto name_ok = [&h](uint32_t off, uint32_t len) {
+		return len < LNX_IFNAME_MAX && off <= h.strtab_size && len <= h.strtab_size - off;
+	};
+	auto prefix_ok = [](int32_t len) { return len >= 0 && len <= 32; };
+	const SnapshotInterface *ifaces = (const SnapshotInterface *) (data + sizeof(h));
+	for (uint32_t i = 0; i < h.n_interfaces; i++) {
+		if (!name_ok(ifaces[i].name_off, ifaces[i].name_len) ||
+		    !prefix_ok(ifaces[i].prefix_len)) {
+			return false;
+		}
+	}
+	const SnapshotNeighbor *neighbors = (const SnapshotNeighbor *) (ifaces + h.n_interfaces);
+	for (uint32_t i = 0; i < h.n_neighbors; i++) {
+		if (!name_ok(neighbors[i].ifname_off, neighbors[i].ifname_len)) {
+			return false;
+		}
+	}
+	const StaticRoute *routes = (const StaticRoute *) (neighbors + h.n_neighbors);
+	for (uint32_t i = 0; i < h.n_static_routes; i++) {
+		if (!prefix_ok(routes[i].prefix_len)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+inline bool lnx::Config::save_snapshot(const char *path, ParseError &err) const {
+	// Not tied to any lnx file, so load_cached will never trust it
+	detail::SnapshotSource none = {0, 0, 0};
+	return write_snapshot(path, none, err);
+}
+
+inline std::string lnx::Config::encode_snapshot(const detail::SnapshotSource &src) const {
+	using namespace detail;
+
+	// Intern interface names, which neighbors mostly repeat
+	std::string strtab;
+	std::unordered_map<std::string, uint32_t> offsets;
+	auto intern = [&](const std::string &name) -> uint32_t {
+		auto it = offsets.find(name);
+		if (it != offsets.end()) {
+			return it->second;
+		}
+		uint32_t off = (uint32_t) strtab.size();
+		strtab += name;
+		offsets.emplace(name, off);
+		return off;
+	};
+
+	SnapshotHeader h;
+	std::memset(&h, 0, sizeof(h));
+	std::memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+	h.version = SNAPSHOT_VERSION;
+	h.byte_order = SNAPSHOT_BYTE_ORDER;
+	h.source = src;
+	h.routing_mode = (uint32_t) m_routing_mode;
+	h.n_interfaces = (uint32_t) m_interfaces.size();
+	h.n_neighbors = (uint32_t) m_neighbors.size();
+	h.n_static_routes = (uint32_t) m_static_routes.size();
+	h.n_rip_neighbors = (uint32_t) m_rip_neighbors.size();
+	h.rip_periodic_update_rate_ms = m_rip_periodic_update_rate_ms;
+	h.rip_timeout_threshold_ms = m_rip_timeout_threshold_ms;
+	h.tcp_rto_min_us = m_tcp_rto_min_us;
+	h.tcp_rto_max_us = m_tcp_rto_max_us;
+
+	std::vector<SnapshotInterface> ifaces(m_interfaces.size());
+	for (size_t i = 0; i < m_interfaces.size(); i++) {
+		const Interface &src_if = m_interfaces[i];
+		SnapshotInterface &si = ifaces[i];
+		std::memset(&si, 0, sizeof(si));
+		si.name_off = intern(src_if.name);
+		si.name_len = (uint32_t) src_if.name.size();
+		si.assigned_ip = src_if.assigned_ip;
+		si.prefix_len = src_if.prefix_len;
+		si.udp_addr = src_if.udp_addr;
+		si.udp_port = src_if.udp_port;
+	}
+
+	std::vector<SnapshotNeighbor> neighbors(m_neighbors.size());
+	for (size_t i = 0; i < m_neighbors.size(); i++) {
+		const Neighbor &src_n = m_neighbors[i];
+		SnapshotNeighbor &sn = neighbors[i];
+		std::memset(&sn, 0, sizeof(sn));
+		sn.dest_addr = src_n.dest_addr;
+		sn.udp_addr = src_n.udp_addr;
+		sn.udp_port = src_n.udp_port;
+		sn.ifname_off = intern(src_n.ifname);
+		sn.ifname_len = (uint32_t) src_n.ifname.size();
+	}
+	h.strtab_size = (uint32_t) strtab.size();
+
+	std::string buf;
+	buf.reserve(sizeof(h) + ifaces.size() * sizeof(SnapshotInterface) +
+		    neighbors.size() * sizeof(SnapshotNeighbor) +
+		    m_static_routes.size() * sizeof(StaticRoute) +
+		    m_rip_neighbors.size() * sizeof(RIPNeighbor) + strtab.size());
+	buf.append((const char *) &h, sizeof(h));
+	buf.append((const char *) ifaces.data(), ifaces.size() * sizeof(SnapshotInterface));
+	buf.append((const char *) neighbors.data(), neighbors.size() * sizeof(SnapshotNeighbor));
+	buf.append((const char *) m_static_routes.data(), m_static_routes.size() * sizeof(StaticRoute));
+	buf.append((const char *) m_rip_neighbors.data(), m_rip_neighbors.size() * sizeof(RIPNeighbor));
+	buf.append(strtab);
+	return buf;
+}
+
+inline bool lnx::Config::write_snapshot(const char *path, const detail::SnapshotSource &src,
+					ParseError &err) const {
+	std::string buf = encode_snapshot(src);
+
+	// Write to a temporary file and rename over the target, so readers
+	// never see a partial snapshot
+	std::string tmp = std::string(path) + ".tmp." + std::to_string(getpid());
+	int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		err.lineno = 0;
+		err.msg = std::string("Failed to create snapshot: ") + std::strerror(errno);
+		return false;
+	}
+
+	size_t off = 0;
+	while (off < buf.size()) {
+		ssize_t n = write(fd, buf.data() + off, buf.size() - off);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			err.lineno = 0;
+			err.msg = std::string("Failed to write snapshot: ") + std::strerror(errno);
+			close(fd);
+			unlink(tmp.c_str());
+			return false;
+		}
+		off += (size_t) n;
+	}
+	close(fd);
 
+	if (rename(tmp.c_str(), path) < 0) {
+		err.lineno = 0;
+		err.msg = std::string("Failed to write snapshot: ") + std::strerror(errno);
+		unlink(tmp.c_str());
+		return false;
 	}
+	return true;
+}
+
+inline std::optional<lnx::Config> lnx::Config::load_snapshot(const char *path, ParseError &err) {
+	return read_snapshot(path, nullptr, err);
 }
 
-void lnx::Config::do_parse_error(std::string msg, int lineno) {
-	std::cerr << "Parse error, line " << lineno << ": " << msg << std::endl;
-  std::exit(1);
+inline std::optional<lnx::Config> lnx::Config::read_snapshot(const char *path,
+							      detail::SnapshotSource *src,
+							      ParseError &err) {
+	MappedFile f(path);
+	if (!f.ok()) {
+		err.lineno = 0;
+		err.msg = std::string("Failed to open snapshot: ") + std::strerror(errno);
+		return std::nullopt;
+	}
+
+	return decode_snapshot(f.data(), f.size(), src, err);
 }
 
-void lnx::Config::parse_addr(char *ip_str, in_addr *addr, int lineno) {
-	std::memset(addr, 0, sizeof(in_addr));
-	if (inet_pton(AF_INET, ip_str, addr) < 0) {
-		do_parse_error("Failed to parse IP address", lineno);
+inline std::optional<lnx::Config> lnx::Config::decode_snapshot(const char *data, size_t size,
+								detail::SnapshotSource *src,
+								ParseError &err) {
+	using namespace detail;
+
+	SnapshotHeader h;
+	if (!check_snapshot(data, size, h, err)) {
+		return std::nullopt;
+	}
+
+	const char *p = data + sizeof(h);
+	const SnapshotInterface *ifaces = (const SnapshotInterface *) p;
+	p += h.n_interfaces * sizeof(SnapshotInterface);
+	const SnapshotNeighbor *neighbors = (const SnapshotNeighbor *) p;
+	p += h.n_neighbors * sizeof(SnapshotNeighbor);
+	const StaticRoute *routes = (const StaticRoute *) p;
+	p += h.n_static_routes * sizeof(StaticRoute);
+	const RIPNeighbor *rip = (const RIPNeighbor *) p;
+	p += h.n_rip_neighbors * sizeof(RIPNeighbor);
+	const char *strtab = p;
+
+	// Names were bounds-checked by check_snapshot
+	Config c;
+	c.m_routing_mode = (RoutingMode) h.routing_mode;
+	c.m_rip_periodic_update_rate_ms = h.rip_periodic_update_rate_ms;
+	c.m_rip_timeout_threshold_ms = h.rip_timeout_threshold_ms;
+	c.m_tcp_rto_min_us = h.tcp_rto_min_us;
+	c.m_tcp_rto_max_us = h.tcp_rto_max_us;
+
+	c.m_interfaces.resize(h.n_interfaces);
+	for (uint32_t i = 0; i < h.n_interfaces; i++) {
+		const SnapshotInterface &si = ifaces[i];
+		Interface &iface = c.m_interfaces[i];
+		iface.name.assign(strtab + si.name_off, si.name_len);
+		iface.assigned_ip = si.assigned_ip;
+		iface.prefix_len = si.prefix_len;
+		iface.udp_addr = si.udp_addr;
+		iface.udp_port = si.udp_port;
+	}
+
+	c.m_neighbors.resize(h.n_neighbors);
+	for (uint32_t i = 0; i < h.n_neighbors; i++) {
+		const SnapshotNeighbor &sn = neighbors[i];
+		Neighbor &n = c.m_neighbors[i];
+		n.dest_addr = sn.dest_addr;
+		n.udp_addr = sn.udp_addr;
+		n.udp_port = sn.udp_port;
+		n.ifname.assign(strtab + sn.ifname_off, sn.ifname_len);
+	}
+
+	c.m_static_routes.assign(routes, routes + h.n_static_routes);
+	c.m_rip_neighbors.assign(rip, rip + h.n_rip_neighbors);
+
+	if (src != nullptr) {
+		*src = h.source;
+	}
+	c.finish();
+	return c;
+}
+
+inline std::optional<lnx::Config> lnx::Config::load_cached(const char *lnx_path,
+							    const char *snapshot_path,
+							    ParseError &err) {
+	detail::SnapshotSource cur, cached;
+	if (!detail::stat_source(lnx_path, cur, err)) {
+		return std::nullopt;
+	}
+
+	ParseError ignored;
+	std::optional<Config> snap = read_snapshot(snapshot_path, &cached, ignored);
+	if (snap && cached.size == cur.size && cached.mtime_ns == cur.mtime_ns && cached.hash != 0) {
+		return snap;
+	}
+
+	MappedFile f(lnx_path);
+	if (!f.ok()) {
+		err.lineno = 0;
+		err.msg = std::string("Failed to open file: ") + std::strerror(errno);
+		return std::nullopt;
+	}
+	cur.hash = detail::hash_bytes(f.data(), f.size());
+
+	if (snap && cached.size == cur.size && cached.hash == cur.hash) {
+		// Only the mtime changed; refresh it so the next load is a stat
+		snap->write_snapshot(snapshot_path, cur, ignored);
+		return snap;
+	}
+
+	std::optional<Config> c = from_string(std::string_view(f.data(), f.size()), err);
+	if (c) {
+		c->write_snapshot(snapshot_path, cur, ignored);
 	}
+	return c;
 }
 
 
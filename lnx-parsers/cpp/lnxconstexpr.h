@@ -0,0 +1,251 @@
+/*
+ * lnxconstexpr.h - Parsing an lnx file at compile time (C++20)
+ *
+ * Companion to lnxconfig.h for images whose topology is fixed at build
+ * time.  LNX_STATIC_CONFIG turns an lnx file embedded as a constant
+ * string into a constexpr lnx::StaticConfig, using the same parser as
+ * lnx::Config, so nothing is parsed at boot and the compiler can fold
+ * interface counts and addresses straight into the code that uses them.
+ */
+
+#ifndef __LNXCONSTEXPR_H__
+#define __LNXCONSTEXPR_H__
+
+#include "lnxconfig.h"
+
+#include <array>
+
+#if __cplusplus < 202002L
+#error "lnxconstexpr.h needs C++20"
+#endif
+#if LNX_STATS
+#error "lnxconstexpr.h does not work with LNX_STATS=1"
+#endif
+
+namespace lnx {
+
+	namespace detail {
+		constexpr std::string_view name_view(const char (&name)[LNX_IFNAME_MAX]) {
+			size_t len = 0;
+			while (len < LNX_IFNAME_MAX && name[len] != '\0') {
+				len++;
+			}
+			return {name, len};
+		}
+	}
+
+	/**
+	 * An interface with its name stored inline, so that it can live in
+	 * a constexpr array.  `name` is NUL-terminated.
+	 */
+	struct StaticInterface {
+		char name[LNX_IFNAME_MAX];
+		in_addr assigned_ip;
+		int prefix_len;
+		in_addr udp_addr;
+		uint16_t udp_port;
+
+		constexpr std::string_view name_view() const { return detail::name_view(name); }
+	};
+
+	/**
+	 * A neighbor with its interface name stored inline.  `ifindex` is
+	 * resolved at compile time, as in Neighbor.
+	 */
+	struct StaticNeighbor {
+		in_addr dest_addr;
+		in_addr udp_addr;
+		uint16_t udp_port;
+		char ifname[LNX_IFNAME_MAX];
+		int ifindex;
+
+		constexpr std::string_view ifname_view() const { return detail::name_view(ifname); }
+	};
+
+	/**
+	 * Number of records of each kind in a file, which sizes the arrays
+	 * of a StaticConfig
+	 */
+	struct StaticCounts {
+		size_t interfaces = 0;
+		size_t neighbors = 0;
+		size_t static_routes = 0;
+		size_t rip_neighbors = 0;
+	};
+
+	/**
+	 * A parsed lnx file as plain fixed-size arrays.  Build one with
+	 * LNX_STATIC_CONFIG, then check it at compile time:
+	 *
+	 *   static_assert(conf.error_lineno == 0, "bad lnx file");
+	 *
+	 * (the compiler shows the offending line number when this fails).
+	 */
+	template <StaticCounts N>
+	struct StaticConfig {
+		RoutingMode routing_mode = RoutingMode::STATIC;
+		std::array<StaticInterface, N.interfaces> interfaces{};
+		std::array<StaticNeighbor, N.neighbors> neighbors{};
+		std::array<StaticRoute, N.static_routes> static_routes{};
+		std::array<RIPNeighbor, N.rip_neighbors> rip_neighbors{};
+
+		uint64_t rip_periodic_update_rate_ms = DEFAULT_RIP_PERIODIC_UPDATE_RATE_MS;
+		uint64_t rip_timeout_threshold_ms = DEFAULT_RIP_TIMEOUT_THRESHOLD_MS;
+		uint64_t tcp_rto_min_us = DEFAULT_TCP_RTO_MIN_US;
+		uint64_t tcp_rto_max_us = DEFAULT_TCP_RTO_MAX_US;
+
+		/**
+		 * Line of the first parse error, with its message in `error`,
+		 * or 0 if the file parsed
+		 */
+		int error_lineno = 0;
+		char error[64] = {};
+
+		/**
+		 * Index of the interface called `name`, or -1
+		 */
+		constexpr int interface_index(std::string_view name) const {
+			for (size_t i = 0; i < interfaces.size(); i++) {
+				if (interfaces[i].name_view() == name) {
+					return (int) i;
+				}
+			}
+			return -1;
+		}
+	};
+
+	/**
+	 * First pass of LNX_STATIC_CONFIG: count the records in `text`
+	 */
+	consteval StaticCounts static_counts(std::string_view text);
+
+	/**
+	 * Second pass: parse `text` into a StaticConfig sized by `N`, which
+	 * must come from static_counts(text)
+	 */
+	template <StaticCounts N>
+	consteval StaticConfig<N> static_parse(std::string_view text);
+
+	namespace detail {
+		constexpr void copy_name(char (&dst)[LNX_IFNAME_MAX], std::string_view src) {
+			// The parser already rejected names that don't fit
+			for (size_t i = 0; i < src.size(); i++) {
+				dst[i] = src[i];
+			}
+			dst[src.size()] = '\0';
+		}
+
+		struct StaticCounter {
+			StaticCounts n;
+
+			constexpr void on_interface(const InterfaceView &, int) { n.interfaces++; }
+			constexpr void on_neighbor(const NeighborView &, int) { n.neighbors++; }
+			constexpr void on_routing(RoutingMode, int) {}
+			constexpr void on_route(const StaticRoute &, int) { n.static_routes++; }
+			constexpr void on_rip(const RIPDirective &r, int) {
+				if (r.kind == RIPDirective::Kind::ADVERTISE_TO) {
+					n.rip_neighbors++;
+				}
+			}
+			constexpr void on_tcp(const TCPDirective &, int) {}
+		};
+
+		template <StaticCounts N>
+		struct StaticBuilder {
+			StaticConfig<N> &c;
+			StaticCounts n;
+
+			constexpr void on_interface(const InterfaceView &v, int) {
+				StaticInterface &i = c.interfaces[n.interfaces++];
+				copy_name(i.name, v.name);
+				i.assigned_ip = v.assigned_ip;
+				i.prefix_len = v.prefix_len;
+				i.udp_addr = v.udp_addr;
+				i.udp_port = v.udp_port;
+			}
+
+			constexpr void on_neighbor(const NeighborView &v, int) {
+				StaticNeighbor &nb = c.neighbors[n.neighbors++];
+				nb.dest_addr = v.dest_addr;
+				nb.udp_addr = v.udp_addr;
+				nb.udp_port = v.udp_port;
+				copy_name(nb.ifname, v.ifname);
+			}
+
+			constexpr void on_routing(RoutingMode mode, int) { c.routing_mode = mode; }
+
+			constexpr void on_route(const StaticRoute &s, int) {
+				c.static_routes[n.static_routes++] = s;
+			}
+
+			constexpr void on_rip(const RIPDirective &r, int) {
+				switch (r.kind) {
+				case RIPDirective::Kind::PERIODIC_UPDATE_RATE:
+					c.rip_periodic_update_rate_ms = r.value_ms;
+					break;
+				case RIPDirective::Kind::ROUTE_TIMEOUT_THRESHOLD:
+					c.rip_timeout_threshold_ms = r.value_ms;
+					break;
+				case RIPDirective::Kind::ADVERTISE_TO:
+					c.rip_neighbors[n.rip_neighbors++] = RIPNeighbor{r.dest};
+					break;
+				}
+			}
+
+			constexpr void on_tcp(const TCPDirective &t, int) {
+				switch (t.kind) {
+				case TCPDirective::Kind::RTO_MIN:
+					c.tcp_rto_min_us = t.value_us;
+					break;
+				case TCPDirective::Kind::RTO_MAX:
+					c.tcp_rto_max_us = t.value_us;
+					break;
+				}
+			}
+		};
+	}
+}
+
+/**
+ * Parse `text`, a constant std::string_view or string literal, into a
+ * constexpr lnx::StaticConfig.  To embed a file, have the build wrap it
+ * in a raw string literal and include that:
+ *
+ *   (echo 'R"lnx('; cat r1.lnx; echo ')lnx"') > r1.lnx.inc
+ *
+ *   constexpr std::string_view text =
+ *   #include "r1.lnx.inc"
+ *   ;
+ *
+ * or use #embed where the compiler supports it.
+ */
+#define LNX_STATIC_CONFIG(text) (::lnx::static_parse<::lnx::static_counts(text)>(text))
+
+consteval lnx::StaticCounts lnx::static_counts(std::string_view text) {
+	detail::StaticCounter counter{};
+	ParseError err = {0, ""};
+	parse(text, counter, err);
+	return counter.n;
+}
+
+template <lnx::StaticCounts N>
+consteval lnx::StaticConfig<N> lnx::static_parse(std::string_view text) {
+	StaticConfig<N> c{};
+	detail::StaticBuilder<N> b{c, {}};
+	ParseError err = {0, ""};
+
+	if (!parse(text, b, err)) {
+		c.error_lineno = err.lineno;
+		for (size_t i = 0; i < err.msg.size() && i + 1 < sizeof(c.error); i++) {
+			c.error[i] = err.msg[i];
+		}
+		return c;
+	}
+
+	for (StaticNeighbor &nb : c.neighbors) {
+		nb.ifindex = c.interface_index(nb.ifname_view());
+	}
+	return c;
+}
+
+#endif // __LNXCONSTEXPR_H__
@@ -0,0 +1,213 @@
+/*
+ * lnxdiff.h - What changed between two versions of a config
+ *
+ * Companion to lnxconfig.h.  lnx::diff compares two Configs entry by
+ * entry, so that tables built from a config (forwarding table, neighbor
+ * map, RIP state) can be updated with just the changed entries when a
+ * file is reloaded, instead of being rebuilt.
+ */
+
+#ifndef __LNXDIFF_H__
+#define __LNXDIFF_H__
+
+#include "lnxconfig.h"
+
+#include <utility>
+
+namespace lnx {
+
+	/**
+	 * Changes to one kind of entry.  Entries are matched by key:
+	 *  - interfaces by name
+	 *  - neighbors by dest_addr
+	 *  - static routes by network_addr/prefix_len, ignoring host bits
+	 *  - RIP neighbors by dest
+	 * A key present in both configs whose other fields differ is
+	 * "modified".  Repeated keys are matched up in file order.
+	 *
+	 * All values are indices into the vectors of the two configs, which
+	 * must outlive the diff.
+	 */
+	struct DiffEntries {
+		/**
+		 * Indices into the new config, in file order
+		 */
+		std::vector<uint32_t> added;
+
+		/**
+		 * Indices into the old config, in file order
+		 */
+		std::vector<uint32_t> removed;
+
+		/**
+		 * (old index, new index) pairs, in new file order
+		 */
+		std::vector<std::pair<uint32_t, uint32_t>> modified;
+
+		bool empty() const { return added.empty() && removed.empty() && modified.empty(); }
+	};
+
+	struct ConfigDiff {
+		DiffEntries interfaces;
+
+		/**
+		 * A neighbor is modified if its UDP address, port or interface
+		 * name changed.  A change in ifindex alone (because interfaces
+		 * were reordered) does not count.
+		 */
+		DiffEntries neighbors;
+
+		/**
+		 * A route is modified if its next hop changed
+		 */
+		DiffEntries static_routes;
+
+		/**
+		 * RIP neighbors have no fields besides the key, so they are
+		 * never modified, only added or removed
+		 */
+		DiffEntries rip_neighbors;
+
+		bool routing_mode_changed = false;
+		bool rip_periodic_update_rate_changed = false;
+		bool rip_timeout_threshold_changed = false;
+		bool tcp_rto_min_changed = false;
+		bool tcp_rto_max_changed = false;
+
+		bool empty() const {
+			return interfaces.empty() && neighbors.empty() && static_routes.empty() &&
+			       rip_neighbors.empty() && !routing_mode_changed &&
+			       !rip_periodic_update_rate_changed && !rip_timeout_threshold_changed &&
+			       !tcp_rto_min_changed && !tcp_rto_max_changed;
+		}
+	};
+
+	/**
+	 * Compare `old_conf` to `new_conf`.  Runs in time linear in the size
+	 * of both configs.
+	 */
+	ConfigDiff diff(const Config &old_conf, const Config &new_conf);
+
+	namespace detail {
+		/**
+		 * Diff two vectors of entries.  `hash(e)` hashes an entry's key,
+		 * `same_key(a, b)` compares keys and `same_value(a, b)` compares
+		 * the remaining fields of two entries with equal keys.
+		 */
+		template <typename T, typename Hash, typename SameKey, typename SameValue>
+		void diff_entries(const std::vector<T> &a, const std::vector<T> &b, Hash hash,
+				  SameKey same_key, SameValue same_value, DiffEntries &out);
+	}
+}
+
+template <typename T, typename Hash, typename SameKey, typename SameValue>
+void lnx::detail::diff_entries(const std::vector<T> &a, const std::vector<T> &b, Hash hash,
+			       SameKey same_key, SameValue same_value, DiffEntries &out) {
+	// Index the old entries by key.  The index holds the first entry
+	// for each key; later entries with the same key are chained from
+	// it through `next`, and `cursor` tracks how far down its chain
+	// each key has been matched.
+	FlatIndex index;
+	index.reset(a.size());
+	std::vector<uint32_t> next(a.size(), FlatIndex::NONE);
+	std::vector<uint32_t> tail(a.size(), FlatIndex::NONE);
+	std::vector<uint32_t> cursor(a.size(), FlatIndex::NONE);
+
+	for (uint32_t i = 0; i < a.size(); i++) {
+		uint32_t h = hash(a[i]);
+		uint32_t head = index.find(h, [&](uint32_t pos) { return same_key(a[pos], a[i]); });
+		if (head == FlatIndex::NONE) {
+			index.insert(h, i, [](uint32_t) { return false; });
+			cursor[i] = tail[i] = i;
+		} else {
+			next[tail[head]] = i;
+			tail[head] = i;
+		}
+	}
+
+	std::vector<bool> matched(a.size(), false);
+	for (uint32_t j = 0; j < b.size(); j++) {
+		const T &e = b[j];
+		uint32_t head = index.find(hash(e), [&](uint32_t pos) { return same_key(a[pos], e); });
+		uint32_t i = head == FlatIndex::NONE ? FlatIndex::NONE : cursor[head];
+		if (i == FlatIndex::NONE) {
+			out.added.push_back(j);
+			continue;
+		}
+
+		cursor[head] = next[i];
+		matched[i] = true;
+		if (!same_value(a[i], e)) {
+			out.modified.push_back({i, j});
+		}
+	}
+
+	for (uint32_t i = 0; i < a.size(); i++) {
+		if (!matched[i]) {
+			out.removed.push_back(i);
+		}
+	}
+}
+
+inline lnx::ConfigDiff lnx::diff(const Config &old_conf, const Config &new_conf) {
+	ConfigDiff d;
+
+	auto same_addr = [](in_addr x, in_addr y) { return x.s_addr == y.s_addr; };
+
+	// 10.0.0.5/24 is the same route as 10.0.0.0/24, as in LpmTable
+	auto route_net = [](const StaticRoute &r) {
+		int len = r.prefix_len;
+		uint32_t mask = len <= 0 ? 0 : len >= 32 ? ~0u : ~0u << (32 - len);
+		return ntohl(r.network_addr.s_addr) & mask;
+	};
+
+	detail::diff_entries(
+		old_conf.interfaces(), new_conf.interfaces(),
+		[](const Interface &i) { return detail::hash_str(i.name); },
+		[](const Interface &x, const Interface &y) { return x.name == y.name; },
+		[&](const Interface &x, const Interface &y) {
+			return same_addr(x.assigned_ip, y.assigned_ip) && x.prefix_len == y.prefix_len &&
+			       same_addr(x.udp_addr, y.udp_addr) && x.udp_port == y.udp_port;
+		},
+		d.interfaces);
+
+	detail::diff_entries(
+		old_conf.neighbors(), new_conf.neighbors(),
+		[](const Neighbor &n) { return detail::hash_u32(n.dest_addr.s_addr); },
+		[&](const Neighbor &x, const Neighbor &y) { return same_addr(x.dest_addr, y.dest_addr); },
+		[&](const Neighbor &x, const Neighbor &y) {
+			return same_addr(x.udp_addr, y.udp_addr) && x.udp_port == y.udp_port &&
+			       x.ifname == y.ifname;
+		},
+		d.neighbors);
+
+	detail::diff_entries(
+		old_conf.static_routes(), new_conf.static_routes(),
+		[&](const StaticRoute &r) {
+			return detail::hash_u32(route_net(r) ^ detail::hash_u32(r.prefix_len));
+		},
+		[&](const StaticRoute &x, const StaticRoute &y) {
+			return route_net(x) == route_net(y) && x.prefix_len == y.prefix_len;
+		},
+		[&](const StaticRoute &x, const StaticRoute &y) { return same_addr(x.next_hop, y.next_hop); },
+		d.static_routes);
+
+	detail::diff_entries(
+		old_conf.rip_neighbors(), new_conf.rip_neighbors(),
+		[](const RIPNeighbor &r) { return detail::hash_u32(r.dest.s_addr); },
+		[&](const RIPNeighbor &x, const RIPNeighbor &y) { return same_addr(x.dest, y.dest); },
+		[](const RIPNeighbor &, const RIPNeighbor &) { return true; },
+		d.rip_neighbors);
+
+	d.routing_mode_changed = old_conf.routing_mode() != new_conf.routing_mode();
+	d.rip_periodic_update_rate_changed =
+		old_conf.rip_periodic_update_rate() != new_conf.rip_periodic_update_rate();
+	d.rip_timeout_threshold_changed =
+		old_conf.rip_timeout_threshold() != new_conf.rip_timeout_threshold();
+	d.tcp_rto_min_changed = old_conf.tcp_rto_min() != new_conf.tcp_rto_min();
+	d.tcp_rto_max_changed = old_conf.tcp_rto_max() != new_conf.tcp_rto_max();
+
+	return d;
+}
+
+#endif // __LNXDIFF_H__
@@ -0,0 +1,309 @@
+/*
+ * lnxlazy.h - Parsing only the parts of an lnx file that are used
+ *
+ * Companion to lnxconfig.h for short-lived processes and hosts, which
+ * read their interfaces, neighbors and `tcp` settings but never a
+ * router's `route` and `rip advertise-to` lines.  lnx::LazyConfig makes
+ * one quick pass over the file that decodes the settings and only notes
+ * where each other line is, then decodes each kind of directive the
+ * first time its accessor is called.
+ */
+
+#ifndef __LNXLAZY_H__
+#define __LNXLAZY_H__
+
+#include "lnxconfig.h"
+
+#include <memory>
+
+namespace lnx {
+
+	/**
+	 * A Config whose directive lists are decoded on first use.  The
+	 * settings (routing mode, RIP and TCP timing) are decoded, and
+	 * checked, up front; a bad interface, neighbor, route or `rip
+	 * advertise-to` line is only found when its list is decoded.  The
+	 * accessors then print the error and exit, like the Config
+	 * constructor; call decode() first to handle errors instead.
+	 *
+	 * Decoding updates the config, so the first call to each accessor
+	 * must not race with other calls.  Call decode() before sharing it
+	 * between threads.
+	 */
+	class LazyConfig {
+	public:
+	    /**
+	     * Scan the file at `path`, printing an error and exiting on a
+	     * bad setting
+	     */
+	    explicit LazyConfig(const char *path);
+
+	    static std::optional<LazyConfig> from_file(const char *path, ParseError &err);
+
+	    /**
+	     * Scan `text`, which is copied
+	     */
+	    static std::optional<LazyConfig> from_string(std::string_view text, ParseError &err);
+
+	    const RoutingMode &routing_mode() const { return m_config.m_routing_mode; }
+	    uint64_t rip_periodic_update_rate() const { return m_config.m_rip_periodic_update_rate_ms; }
+	    uint64_t rip_timeout_threshold() const { return m_config.m_rip_timeout_threshold_ms; }
+	    uint64_t tcp_rto_min() const { return m_config.m_tcp_rto_min_us; }
+	    uint64_t tcp_rto_max() const { return m_config.m_tcp_rto_max_us; }
+
+	    const std::vector<Interface> &interfaces() const;
+
+	    /**
+	     * Also decodes interfaces(), to resolve each neighbor's ifindex
+	     */
+	    const std::vector<Neighbor> &neighbors() const;
+
+	    const std::vector<RIPNeighbor> &rip_neighbors() const;
+	    const std::vector<StaticRoute> &static_routes() const;
+
+	    int interface_index(std::string_view name) const;
+	    const Interface *find_interface(std::string_view name) const;
+	    const Neighbor *find_neighbor(in_addr dest_addr) const;
+
+	    /**
+	     * Decode everything not yet decoded.  Returns false with the
+	     * first bad line in `err` if any fails.
+	     */
+	    bool decode(ParseError &err) const;
+
+	    /**
+	     * The whole config, decoding what is left, for the lookups and
+	     * companions (LpmTable, RIPAdvertiser, ...) that take a Config
+	     */
+	    const Config &config() const;
+
+	private:
+	    enum Section {
+		INTERFACES,
+		NEIGHBORS,
+		RIP_NEIGHBORS,
+		STATIC_ROUTES,
+		NUM_SECTIONS,
+	    };
+
+	    /**
+	     * Where one deferred line is, as offsets into the text
+	     */
+	    struct LineRef {
+		size_t begin;
+		size_t end;
+		int lineno;
+	    };
+
+	    LazyConfig() = default;
+
+	    bool scan(ParseError &err);
+	    bool decode(Section s, ParseError &err) const;
+	    void require(Section s) const;
+
+	    const char *text() const { return m_file ? m_file->data() : m_text.data(); }
+	    size_t text_size() const { return m_file ? m_file->size() : m_text.size(); }
+
+	    // Exactly one of these holds the text
+	    std::unique_ptr<MappedFile> m_file;
+	    std::string m_text;
+
+	    std::vector<LineRef> m_lines[NUM_SECTIONS];
+	    mutable bool m_decoded[NUM_SECTIONS] = {};
+	    mutable Config m_config;
+	};
+}
+
+inline lnx::LazyConfig::LazyConfig(const char *path) {
+	ParseError err;
+	m_file = std::make_unique<MappedFile>(path);
+	if (!m_file->ok()) {
+		err.lineno = 0;
+		err.msg = std::string("Failed to open file: ") + std::strerror(errno);
+		detail::die(err);
+	}
+	if (!scan(err)) {
+		detail::die(err);
+	}
+}
+
+inline std::optional<lnx::LazyConfig> lnx::LazyConfig::from_file(const char *path,
+								  ParseError &err) {
+	LazyConfig c;
+	c.m_file = std::make_unique<MappedFile>(path);
+	if (!c.m_file->ok()) {
+		err.lineno = 0;
+		err.msg = std::string("Failed to open file: ") + std::strerror(errno);
+		return std::nullopt;
+	}
+	if (!c.scan(err)) {
+		return std::nullopt;
+	}
+	return c;
+}
+
+inline std::optional<lnx::LazyConfig> lnx::LazyConfig::from_string(std::string_view text,
+								    ParseError &err) {
+	LazyConfig c;
+	c.m_text.assign(text);
+	if (!c.scan(err)) {
+		return std::nullopt;
+	}
+	return c;
+}
+
+// One pass over the text: note where each deferred line is, and decode
+// everything else now.  The keyword tests are the ones parse_line makes,
+// so a line is deferred exactly when parsing it would add to a list.
+inline bool lnx::LazyConfig::scan(ParseError &err) {
+	using namespace detail;
+	const char *base = text();
+	const char *end = base + text_size();
+	Config::Builder b(m_config);
+
+	const char *p = base;
+	int lineno = 0;
+	while (p < end) {
+		const char *eol = find_eol(p, end);
+		lineno++;
+
+		LineScanner sc(p, eol, end);
+		std::string_view keyword, sub;
+		Section s = NUM_SECTIONS;
+		bool now = false;
+		if (sc.word(keyword)) {
+			switch (lookup_keyword(keyword)) {
+			case Keyword::INTERFACE:
+				s = INTERFACES;
+				break;
+			case Keyword::NEIGHBOR:
+				s = NEIGHBORS;
+				break;
+			case Keyword::ROUTE:
+				s = STATIC_ROUTES;
+				break;
+			case Keyword::RIP:
+				if (sc.word(sub) && lookup_keyword(sub) == Keyword::ADVERTISE_TO) {
+					s = RIP_NEIGHBORS;
+				} else {
+					now = true;
+				}
+				break;
+			case Keyword::ROUTING:
+			case Keyword::TCP:
+				now = true;
+				break;
+			default:
+				// Unknown directives are ignored
+				break;
+			}
+		}
+
+		if (s != NUM_SECTIONS) {
+			m_lines[s].push_back({(size_t) (p - base), (size_t) (eol - base), lineno});
+		} else if (now && !parse_line(p, eol, end, lineno, b, err)) {
+			return false;
+		}
+		p = eol + 1;
+	}
+	return true;
+}
+
+inline bool lnx::LazyConfig::decode(Section s, ParseError &err) const {
+	if (m_decoded[s]) {
+		return true;
+	}
+	if (s == NEIGHBORS && !decode(INTERFACES, err)) {
+		return false;
+	}
+
+	const char *base = text();
+	const char *limit = base + text_size();
+	Config::Builder b(m_config);
+	for (const LineRef &l : m_lines[s]) {
+		if (!detail::parse_line(base + l.begin, base + l.end, limit, l.lineno, b, err)) {
+			// Start over from scratch if asked again
+			switch (s) {
+			case INTERFACES: m_config.m_interfaces.clear(); break;
+			case NEIGHBORS: m_config.m_neighbors.clear(); break;
+			case RIP_NEIGHBORS: m_config.m_rip_neighbors.clear(); break;
+			case STATIC_ROUTES: m_config.m_static_routes.clear(); break;
+			case NUM_SECTIONS: break;
+			}
+			return false;
+		}
+	}
+	m_decoded[s] = true;
+
+	// Rebuild the name and address indexes (and each neighbor's
+	// ifindex) to cover what was added
+	if (s == INTERFACES || s == NEIGHBORS) {
+		m_config.finish();
+	}
+	return true;
+}
+
+inline void lnx::LazyConfig::require(Section s) const {
+	ParseError err;
+	if (!decode(s, err)) {
+		detail::die(err);
+	}
+}
+
+inline const std::vector<lnx::Interface> &lnx::LazyConfig::interfaces() const {
+	require(INTERFACES);
+	return m_config.m_interfaces;
+}
+
+inline const std::vector<lnx::Neighbor> &lnx::LazyConfig::neighbors() const {
+	require(NEIGHBORS);
+	return m_config.m_neighbors;
+}
+
+inline const std::vector<lnx::RIPNeighbor> &lnx::LazyConfig::rip_neighbors() const {
+	require(RIP_NEIGHBORS);
+	return m_config.m_rip_neighbors;
+}
+
+inline const std::vector<lnx::StaticRoute> &lnx::LazyConfig::static_routes() const {
+	require(STATIC_ROUTES);
+	return m_config.m_static_routes;
+}
+
+inline int lnx::LazyConfig::interface_index(std::string_view name) const {
+	require(INTERFACES);
+	return m_config.interface_index(name);
+}
+
+inline const lnx::Interface *lnx::LazyConfig::find_interface(std::string_view name) const {
+	require(INTERFACES);
+	return m_config.find_interface(name);
+}
+
+inline const lnx::Neighbor *lnx::LazyConfig::find_neighbor(in_addr dest_addr) const {
+	require(NEIGHBORS);
+	return m_config.find_neighbor(dest_addr);
+}
+
+inline bool lnx::LazyConfig::decode(ParseError &err) const {
+	// Decode every section, then report the earliest bad line of all
+	bool ok = true;
+	for (int s = 0; s < NUM_SECTIONS; s++) {
+		ParseError e;
+		if (!decode((Section) s, e) && (ok || e.lineno < err.lineno)) {
+			err = e;
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+inline const lnx::Config &lnx::LazyConfig::config() const {
+	ParseError err;
+	if (!decode(err)) {
+		detail::die(err);
+	}
+	return m_config;
+}
+
+#endif // __LNXLAZY_H__
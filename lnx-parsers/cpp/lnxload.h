@@ -0,0 +1,417 @@
+/*
+ * lnxload.h - Parallel loader for many lnx files, or one very large one
+ *
+ * Companion to lnxconfig.h for programs that need the configs of every
+ * node at once, such as an emulator building a view of the whole
+ * topology, and for nodes whose own file holds far more routes than
+ * one core parses quickly.  Files are parsed on a pool of worker
+ * threads; build with -pthread.
+ */
+
+#ifndef __LNXLOAD_H__
+#define __LNXLOAD_H__
+
+#include "lnxconfig.h"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <thread>
+
+namespace lnx {
+
+	/**
+	 * Outcome of loading one file.
+	 */
+	struct LoadResult {
+		/**
+		 * Path of the file, as given to load_many
+		 */
+		std::string path;
+
+		/**
+		 * The parsed config, or std::nullopt if the file could not be
+		 * opened or parsed
+		 */
+		std::optional<Config> config;
+
+		/**
+		 * Why the file failed; only meaningful if `config` is empty
+		 */
+		ParseError error = {0, ""};
+	};
+
+	/**
+	 * Parse every file in `paths` using `threads` worker threads (0 means
+	 * one per hardware thread).  Results are returned in the same order as
+	 * `paths`.  A bad file only fails its own entry, the rest of the batch
+	 * is still loaded.
+	 */
+	std::vector<LoadResult> load_many(const std::vector<std::string> &paths,
+					  unsigned threads = 0);
+
+	/**
+	 * Load every `*.lnx` file in directory `dir`, sorted by path.  If the
+	 * directory itself cannot be read, returns a single failed entry for
+	 * `dir`.
+	 */
+	std::vector<LoadResult> load_dir(const std::string &dir, unsigned threads = 0);
+
+	/**
+	 * Parse one large file on `threads` threads (0 means one per
+	 * hardware thread), for the same result as Config::from_file.  The
+	 * mapped file is split into chunks at line boundaries, each parsed
+	 * into its own vectors, and the chunks are appended in file order.
+	 * A setting given more than once keeps its last value, and an error
+	 * is the first bad line of the file, with its line number in the
+	 * whole file.  Files too small to split are parsed on this thread.
+	 */
+	std::optional<Config> load_parallel(const char *path, ParseError &err, unsigned threads = 0);
+
+	namespace detail {
+		/**
+		 * Smallest chunk load_parallel hands to a thread
+		 */
+		static constexpr size_t MIN_CHUNK_BYTES = 256 * 1024;
+
+		/**
+		 * Config builder for one chunk that also notes which settings
+		 * the chunk gave, so that the merge knows whose value is last
+		 */
+		template <typename B>
+		struct ChunkBuilder : public B {
+			enum : unsigned {
+				ROUTING = 1,
+				RIP_PERIODIC_UPDATE_RATE = 2,
+				RIP_TIMEOUT_THRESHOLD = 4,
+				TCP_RTO_MIN = 8,
+				TCP_RTO_MAX = 16,
+			};
+
+			unsigned set = 0;
+
+			using B::B;
+
+			void on_routing(RoutingMode mode, int lineno) {
+				B::on_routing(mode, lineno);
+				set |= ROUTING;
+			}
+
+			void on_rip(const RIPDirective &r, int lineno) {
+				B::on_rip(r, lineno);
+				if (r.kind == RIPDirective::Kind::PERIODIC_UPDATE_RATE) {
+					set |= RIP_PERIODIC_UPDATE_RATE;
+				} else if (r.kind == RIPDirective::Kind::ROUTE_TIMEOUT_THRESHOLD) {
+					set |= RIP_TIMEOUT_THRESHOLD;
+				}
+			}
+
+			void on_tcp(const TCPDirective &t, int lineno) {
+				B::on_tcp(t, lineno);
+				set |= t.kind == TCPDirective::Kind::RTO_MIN ? TCP_RTO_MIN : TCP_RTO_MAX;
+			}
+		};
+
+		/**
+		 * Append `from` to `to`, moving the elements
+		 */
+		template <typename T>
+		void append(std::vector<T> &to, std::vector<T> &from) {
+			to.insert(to.end(), std::make_move_iterator(from.begin()),
+				  std::make_move_iterator(from.end()));
+		}
+
+		/**
+		 * Add a chunk's parse times, line counts and allocations into
+		 * the whole file's.  Memory is left to the caller: the chunk's
+		 * buffers are gone by the time the merged config is returned.
+		 */
+		void add_stats(ParseStats &to, const ParseStats &from);
+
+		/**
+		 * A worker's share of the batch: the range of item indices
+		 * [lo, hi), packed into one word.  The owner takes items from
+		 * the front and idle workers steal from the back, both with a
+		 * single CAS, so uneven file sizes even out without a shared
+		 * queue or lock.
+		 */
+		struct alignas(64) WorkRange {
+			std::atomic<uint64_t> bounds;
+
+			void reset(uint32_t lo, uint32_t hi) {
+				bounds.store(((uint64_t) hi << 32) | lo, std::memory_order_relaxed);
+			}
+
+			bool take_front(uint32_t &item) {
+				uint64_t b = bounds.load(std::memory_order_relaxed);
+				for (;;) {
+					uint32_t lo = (uint32_t) b, hi = (uint32_t) (b >> 32);
+					if (lo >= hi) {
+						return false;
+					}
+					uint64_t nb = ((uint64_t) hi << 32) | (lo + 1);
+					if (bounds.compare_exchange_weak(b, nb, std::memory_order_acq_rel)) {
+						item = lo;
+						return true;
+					}
+				}
+			}
+
+			bool take_back(uint32_t &item) {
+				uint64_t b = bounds.load(std::memory_order_relaxed);
+				for (;;) {
+					uint32_t lo = (uint32_t) b, hi = (uint32_t) (b >> 32);
+					if (lo >= hi) {
+						return false;
+					}
+					uint64_t nb = ((uint64_t) (hi - 1) << 32) | lo;
+					if (bounds.compare_exchange_weak(b, nb, std::memory_order_acq_rel)) {
+						item = hi - 1;
+						return true;
+					}
+				}
+			}
+		};
+
+		/**
+		 * Run `fn(i)` for every i in [0, n) on `threads` threads,
+		 * balancing with WorkRange.  Returns once all items are done.
+		 */
+		template <typename F>
+		void run_stealing(size_t n, unsigned threads, F fn);
+	}
+}
+
+template <typename F>
+void lnx::detail::run_stealing(size_t n, unsigned threads, F fn) {
+	if (threads == 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	if (threads > n) {
+		threads = (unsigned) std::max<size_t>(n, 1);
+	}
+
+	std::vector<WorkRange> ranges(threads);
+	for (unsigned t = 0; t < threads; t++) {
+		ranges[t].reset((uint32_t) (n * t / threads), (uint32_t) (n * (t + 1) / threads));
+	}
+
+	auto worker = [&](unsigned self) {
+		uint32_t item;
+		for (;;) {
+			if (ranges[self].take_front(item)) {
+				fn(item);
+				continue;
+			}
+
+			// Out of local work, steal one item from someone else
+			bool stole = false;
+			for (unsigned k = 1; k < threads && !stole; k++) {
+				if (ranges[(self + k) % threads].take_back(item)) {
+					fn(item);
+					stole = true;
+				}
+			}
+			if (!stole) {
+				return;
+			}
+		}
+	};
+
+	std::vector<std::thread> pool;
+	for (unsigned t = 1; t < threads; t++) {
+		pool.emplace_back(worker, t);
+	}
+	worker(0);
+	for (auto &th : pool) {
+		th.join();
+	}
+}
+
+inline std::vector<lnx::LoadResult> lnx::load_many(const std::vector<std::string> &paths,
+						   unsigned threads) {
+	std::vector<LoadResult> results(paths.size());
+
+	// Each slot is written by exactly one worker, so no locking needed
+	detail::run_stealing(paths.size(), threads, [&](size_t i) {
+		LoadResult &r = results[i];
+		r.path = paths[i];
+		r.config = Config::from_file(paths[i].c_str(), r.error);
+	});
+
+	return results;
+}
+
+inline std::vector<lnx::LoadResult> lnx::load_dir(const std::string &dir, unsigned threads) {
+	std::vector<std::string> paths;
+	std::error_code ec;
+
+	for (auto &entry : std::filesystem::directory_iterator(dir, ec)) {
+		if (entry.is_regular_file() && entry.path().extension() == ".lnx") {
+			paths.push_back(entry.path().string());
+		}
+	}
+	if (ec) {
+		LoadResult r;
+		r.path = dir;
+		r.error = {0, "Failed to read directory: " + ec.message()};
+		return {r};
+	}
+
+	std::sort(paths.begin(), paths.end());
+	return load_many(paths, threads);
+}
+
+inline void lnx::detail::add_stats(ParseStats &to, const ParseStats &from) {
+	to.addr_cycles += from.addr_cycles;
+	to.build_cycles += from.build_cycles;
+	to.parse_cycles += from.parse_cycles;
+	to.lines += from.lines;
+	to.blank_lines += from.blank_lines;
+	to.interface_lines += from.interface_lines;
+	to.neighbor_lines += from.neighbor_lines;
+	to.routing_lines += from.routing_lines;
+	to.route_lines += from.route_lines;
+	to.rip_lines += from.rip_lines;
+	to.tcp_lines += from.tcp_lines;
+	to.unknown_lines += from.unknown_lines;
+	to.allocations += from.allocations;
+}
+
+inline std::optional<lnx::Config> lnx::load_parallel(const char *path, ParseError &err,
+						     unsigned threads) {
+	// The scope is for mapping the file (read_cycles) and for merging;
+	// chunks record into their own
+	Config c;
+	LNX_STATS_SCOPE(c.m_stats);
+	MappedFile f(path);
+	if (!f.ok()) {
+		err.lineno = 0;
+		err.msg = std::string("Failed to open file: ") + std::strerror(errno);
+		return std::nullopt;
+	}
+	if (threads == 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	// A few chunks per thread, so that work stealing can even out
+	// chunks that are slower to parse
+	const char *data = f.data();
+	size_t size = f.size();
+	size_t n = threads == 1 ? 1 : std::min<size_t>(threads * 4, size / detail::MIN_CHUNK_BYTES);
+	if (n <= 1) {
+		LNX_STATS_ADD(bytes_read, size);
+		Config::Builder b(c);
+		if (!parse(std::string_view(data, size), b, err)) {
+			return std::nullopt;
+		}
+		c.finish();
+		return c;
+	}
+
+	// Chunk k is [bounds[k], bounds[k + 1]).  Each boundary is moved
+	// to just past a newline, so no line is split and every chunk but
+	// the last ends in '\n', as detail::parse_line expects.
+	std::vector<size_t> bounds(n + 1, size);
+	bounds[0] = 0;
+	for (size_t k = 1; k < n; k++) {
+		size_t at = std::max(bounds[k - 1], size * k / n);
+		const char *nl = at < size ? (const char *) memchr(data + at, '\n', size - at) : nullptr;
+		bounds[k] = nl ? nl + 1 - data : size;
+	}
+
+	std::vector<Config> parts;
+	parts.reserve(n);
+	for (size_t k = 0; k < n; k++) {
+		parts.push_back(Config());
+	}
+	std::vector<unsigned> set(n, 0);
+	std::vector<ParseError> errors(n, ParseError{0, ""});
+
+	// Chunks after the first bad one cannot matter, so they are skipped
+	std::atomic<size_t> first_bad{n};
+
+	detail::run_stealing(n, threads, [&](size_t k) {
+		if (k > first_bad.load(std::memory_order_relaxed)) {
+			return;
+		}
+		Config &part = parts[k];
+		LNX_STATS_SCOPE(part.m_stats);
+		detail::ChunkBuilder<Config::Builder> b(part);
+		std::string_view text(data + bounds[k], bounds[k + 1] - bounds[k]);
+		if (parse(text, b, errors[k])) {
+			set[k] = b.set;
+			return;
+		}
+		size_t bad = first_bad.load(std::memory_order_relaxed);
+		while (k < bad && !first_bad.compare_exchange_weak(bad, k, std::memory_order_relaxed)) {
+		}
+	});
+
+	size_t bad = first_bad.load();
+	if (bad < n) {
+		// Every chunk before it parsed, and each ended in a newline
+		err = errors[bad];
+		err.lineno += (int) std::count(data, data + bounds[bad], '\n');
+		return std::nullopt;
+	}
+
+	using B = detail::ChunkBuilder<Config::Builder>;
+	LNX_STATS_ADD(bytes_read, size);
+	size_t n_interfaces = 0, n_neighbors = 0, n_rip = 0, n_routes = 0;
+	for (const Config &part : parts) {
+		n_interfaces += part.m_interfaces.size();
+		n_neighbors += part.m_neighbors.size();
+		n_rip += part.m_rip_neighbors.size();
+		n_routes += part.m_static_routes.size();
+	}
+	c.m_interfaces.reserve(n_interfaces);
+	c.m_neighbors.reserve(n_neighbors);
+	c.m_rip_neighbors.reserve(n_rip);
+	c.m_static_routes.reserve(n_routes);
+	LNX_STATS_GROW(0, c.m_interfaces.capacity() * sizeof(Interface));
+	LNX_STATS_GROW(0, c.m_neighbors.capacity() * sizeof(Neighbor));
+	LNX_STATS_GROW(0, c.m_rip_neighbors.capacity() * sizeof(RIPNeighbor));
+	LNX_STATS_GROW(0, c.m_static_routes.capacity() * sizeof(StaticRoute));
+	uint64_t chunk_peak_bytes = 0;
+
+	for (size_t k = 0; k < n; k++) {
+		Config &part = parts[k];
+		detail::append(c.m_interfaces, part.m_interfaces);
+		detail::append(c.m_neighbors, part.m_neighbors);
+		detail::append(c.m_rip_neighbors, part.m_rip_neighbors);
+		detail::append(c.m_static_routes, part.m_static_routes);
+
+		// Later chunks overwrite earlier ones, as later lines would
+		if (set[k] & B::ROUTING) {
+			c.m_routing_mode = part.m_routing_mode;
+		}
+		if (set[k] & B::RIP_PERIODIC_UPDATE_RATE) {
+			c.m_rip_periodic_update_rate_ms = part.m_rip_periodic_update_rate_ms;
+		}
+		if (set[k] & B::RIP_TIMEOUT_THRESHOLD) {
+			c.m_rip_timeout_threshold_ms = part.m_rip_timeout_threshold_ms;
+		}
+		if (set[k] & B::TCP_RTO_MIN) {
+			c.m_tcp_rto_min_us = part.m_tcp_rto_min_us;
+		}
+		if (set[k] & B::TCP_RTO_MAX) {
+			c.m_tcp_rto_max_us = part.m_tcp_rto_max_us;
+		}
+		if (c.m_stats.enabled) {
+			detail::add_stats(c.m_stats, part.m_stats);
+			chunk_peak_bytes += part.m_stats.peak_bytes;
+		}
+	}
+
+	c.finish();
+
+	// Every chunk is alive until the merge is done, so the peak is
+	// bounded by all of their peaks plus what the merged config grew
+	// to (its vectors and indexes).  live_bytes is the merged config's
+	// only.
+	c.m_stats.peak_bytes += chunk_peak_bytes;
+	return c;
+}
+
+#endif // __LNXLOAD_H__
@@ -0,0 +1,206 @@
+/*
+ * lnxlocal.h - Is a packet for us, or for a directly connected network?
+ *
+ * Companion to lnxconfig.h.  lnx::LocalClassifier answers the question
+ * a node asks of every packet before it looks at routes: is the
+ * destination one of our interfaces' addresses, and if not, is it on
+ * one of their networks.  The interfaces' addresses, networks and masks
+ * are kept as the padded arrays of InterfaceArrays and compared against
+ * an address LNX_SOA_LANES interfaces at a time, with SSE2 or AVX2 on
+ * x86, NEON on ARM and a plain loop elsewhere.
+ */
+
+#ifndef __LNXLOCAL_H__
+#define __LNXLOCAL_H__
+
+#include "lnxconfig.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace lnx {
+
+	/**
+	 * Where a destination address is, from this node's point of view
+	 */
+	struct Locality {
+		enum Kind {
+			/**
+			 * One of our interface addresses
+			 */
+			LOCAL,
+
+			/**
+			 * On the network of one of our interfaces
+			 */
+			CONNECTED,
+
+			/**
+			 * Neither; look up a route
+			 */
+			REMOTE,
+		};
+
+		Kind kind;
+
+		/**
+		 * The interface the address belongs to or is connected through,
+		 * or -1 for REMOTE
+		 */
+		int ifindex;
+	};
+
+	class LocalClassifier {
+	public:
+	    explicit LocalClassifier(const Config &conf) : LocalClassifier(conf.arrays().interfaces) {}
+
+	    /**
+	     * Build from arrays already taken with Config::arrays()
+	     */
+	    explicit LocalClassifier(const InterfaceArrays &arrays);
+
+	    /**
+	     * Index of the interface whose assigned_ip is `addr`, or -1
+	     */
+	    int local_interface(in_addr addr) const;
+
+	    /**
+	     * Index of the interface whose network contains `addr`, or -1.
+	     * If several do, the one with the longest prefix wins, and the
+	     * first of those in file order.
+	     */
+	    int connected_interface(in_addr addr) const;
+
+	    Locality classify(in_addr addr) const;
+
+	    /**
+	     * Classify `n` addresses (in network byte order, as in in_addr)
+	     * into `out`
+	     */
+	    void classify(const uint32_t *addrs, size_t n, Locality *out) const;
+
+	private:
+	    // Bit k of the result is set if (addr & mask[k]) == value[k], for
+	    // the LNX_SOA_LANES lanes starting at `value` and `mask`
+	    static uint32_t match(const uint32_t *value, const uint32_t *mask, uint32_t addr);
+
+	    // Index of the first lane that matches `addr`, or with `longest`
+	    // the first of those with the longest mask; -1 if none does
+	    int find(const std::vector<uint32_t> &value, const std::vector<uint32_t> &mask,
+		     uint32_t addr, bool longest) const;
+
+	    // Addresses as value/mask pairs as well, so that one kernel does
+	    // both lookups: padding lanes have mask 0 and value 0xffffffff
+	    std::vector<uint32_t> m_addr;
+	    std::vector<uint32_t> m_addr_mask;
+
+	    std::vector<uint32_t> m_network;
+	    std::vector<uint32_t> m_netmask;
+	};
+}
+
+static_assert(LNX_SOA_LANES == 8, "LocalClassifier::match assumes 8 lanes");
+
+inline lnx::LocalClassifier::LocalClassifier(const InterfaceArrays &arrays)
+	: m_addr(arrays.assigned_ip), m_addr_mask(arrays.assigned_ip.size(), 0),
+	  m_network(arrays.network), m_netmask(arrays.netmask) {
+	for (size_t i = 0; i < m_addr.size(); i++) {
+		if (i < arrays.size) {
+			m_addr_mask[i] = 0xffffffff;
+		} else {
+			m_addr[i] = 0xffffffff;
+		}
+	}
+}
+
+inline uint32_t lnx::LocalClassifier::match(const uint32_t *value, const uint32_t *mask,
+					     uint32_t addr) {
+#if defined(__AVX2__)
+	__m256i a = _mm256_set1_epi32((int) addr);
+	__m256i v = _mm256_loadu_si256((const __m256i *) value);
+	__m256i m = _mm256_loadu_si256((const __m256i *) mask);
+	__m256i eq = _mm256_cmpeq_epi32(_mm256_and_si256(a, m), v);
+	return (uint32_t) _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+#elif defined(__SSE2__)
+	__m128i a = _mm_set1_epi32((int) addr);
+	uint32_t bits = 0;
+	for (int h = 0; h < 2; h++) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (value + 4 * h));
+		__m128i m = _mm_loadu_si128((const __m128i *) (mask + 4 * h));
+		__m128i eq = _mm_cmpeq_epi32(_mm_and_si128(a, m), v);
+		bits |= (uint32_t) _mm_movemask_ps(_mm_castsi128_ps(eq)) << (4 * h);
+	}
+	return bits;
+#elif defined(__aarch64__)
+	static const uint32_t weights[4] = {1, 2, 4, 8};
+	uint32x4_t a = vdupq_n_u32(addr);
+	uint32x4_t w = vld1q_u32(weights);
+	uint32_t bits = 0;
+	for (int h = 0; h < 2; h++) {
+		uint32x4_t eq = vceqq_u32(vandq_u32(a, vld1q_u32(mask + 4 * h)), vld1q_u32(value + 4 * h));
+		bits |= vaddvq_u32(vandq_u32(eq, w)) << (4 * h);
+	}
+	return bits;
+#else
+	uint32_t bits = 0;
+	for (int k = 0; k < LNX_SOA_LANES; k++) {
+		bits |= (uint32_t) ((addr & mask[k]) == value[k]) << k;
+	}
+	return bits;
+#endif
+}
+
+inline int lnx::LocalClassifier::find(const std::vector<uint32_t> &value,
+				      const std::vector<uint32_t> &mask, uint32_t addr,
+				      bool longest) const {
+	int best = -1;
+	uint32_t best_mask = 0;
+	for (size_t base = 0; base < value.size(); base += LNX_SOA_LANES) {
+		uint32_t bits = match(&value[base], &mask[base], addr);
+		while (bits != 0) {
+			int i = (int) base + __builtin_ctz(bits);
+			bits &= bits - 1;
+			if (!longest) {
+				return i;
+			}
+			uint32_t m = ntohl(mask[i]);
+			if (best < 0 || m > best_mask) {
+				best = i;
+				best_mask = m;
+			}
+		}
+	}
+	return best;
+}
+
+inline int lnx::LocalClassifier::local_interface(in_addr addr) const {
+	return find(m_addr, m_addr_mask, addr.s_addr, false);
+}
+
+inline int lnx::LocalClassifier::connected_interface(in_addr addr) const {
+	return find(m_network, m_netmask, addr.s_addr, true);
+}
+
+inline lnx::Locality lnx::LocalClassifier::classify(in_addr addr) const {
+	int i = local_interface(addr);
+	if (i >= 0) {
+		return {Locality::LOCAL, i};
+	}
+	i = connected_interface(addr);
+	return {i >= 0 ? Locality::CONNECTED : Locality::REMOTE, i};
+}
+
+inline void lnx::LocalClassifier::classify(const uint32_t *addrs, size_t n, Locality *out) const {
+	for (size_t k = 0; k < n; k++) {
+		in_addr a;
+		a.s_addr = addrs[k];
+		out[k] = classify(a);
+	}
+}
+
+#endif // __LNXLOCAL_H__
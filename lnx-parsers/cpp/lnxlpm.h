@@ -0,0 +1,588 @@
+/*
+ * lnxlpm.h - Longest-prefix-match forwarding table built from an lnx::Config
+ *
+ * This is a DIR-24-8 table: a 2^24-entry first level indexed by the top
+ * 24 bits of the address, plus 256-entry second-level groups for the
+ * few /24s that contain longer prefixes.  A lookup is one memory access
+ * for prefixes up to /24 and two otherwise, independent of the number
+ * of routes.
+ *
+ * The first level is 64MB of virtual memory, allocated with calloc so
+ * that pages are only touched as prefixes fill them in.
+ */
+
+#ifndef __LNXLPM_H__
+#define __LNXLPM_H__
+
+#include "lnxconfig.h"
+
+#include <algorithm>
+#include <memory>
+
+namespace lnx {
+
+	/**
+	 * One route in an LpmTable.
+	 */
+	struct LpmRoute {
+		/**
+		 * The prefix, with host bits cleared
+		 */
+		in_addr network_addr;
+		int prefix_len;
+
+		/**
+		 * Where to send matching packets.  0.0.0.0 for directly
+		 * connected networks (send straight to the destination).
+		 */
+		in_addr next_hop;
+
+		/**
+		 * Outgoing interface, as an index into Config::interfaces().  For
+		 * static routes this is the interface whose network contains
+		 * next_hop, or -1 if no interface does.
+		 */
+		int ifindex;
+
+		/**
+		 * True for an interface's own network, false for a `route`
+		 */
+		bool connected;
+	};
+
+	class LpmTable {
+	public:
+	    /**
+	     * Returned by lookup when no route matches
+	     */
+	    static constexpr uint32_t NO_ROUTE = UINT32_MAX;
+
+	    /**
+	     * An empty table
+	     */
+	    LpmTable();
+
+	    /**
+	     * A table holding the connected network of every interface and
+	     * every static route in `config`.  If a static route has the same
+	     * prefix as a connected network, the connected network wins.
+	     */
+	    LpmTable(const Config &config) : LpmTable(config, config.static_routes()) {}
+
+	    /**
+	     * Same, with `routes` in place of the config's static routes,
+	     * e.g. the output of aggregate_routes(config)
+	     */
+	    LpmTable(const Config &config, const std::vector<StaticRoute> &routes);
+
+	    /**
+	     * Add or replace the route for route.network_addr/route.prefix_len.
+	     * Returns its route id, or NO_ROUTE if prefix_len is out of range.
+	     */
+	    uint32_t add(const LpmRoute &route);
+
+	    /**
+	     * Remove the route for network_addr/prefix_len, so that addresses
+	     * it covered fall back to the next-longest match.  Returns false if
+	     * there was no such route.
+	     */
+	    bool remove(in_addr network_addr, int prefix_len);
+
+	    /**
+	     * Route id of the longest prefix matching `addr`, or NO_ROUTE.
+	     */
+	    uint32_t lookup(in_addr addr) const;
+
+	    /**
+	     * Look up `n` addresses at once, writing their route ids to `out`.
+	     * The first-level entries for the whole batch are prefetched before
+	     * any are read, so cache misses overlap instead of serializing.
+	     */
+	    void lookup(const in_addr *addrs, size_t n, uint32_t *out) const;
+
+	    /**
+	     * The route with the given id (as returned by lookup)
+	     */
+	    const LpmRoute &route(uint32_t id) const { return m_routes[id]; }
+
+	    /**
+	     * Number of routes in the table
+	     */
+	    size_t size() const { return m_rules.size(); }
+
+	private:
+	    // Entry encoding, shared by both levels:
+	    //   bit 31      VALID, a route matches
+	    //   bit 30      EXT (first level only), low 24 bits are a group
+	    //   bits 24-29  prefix length of the matching route
+	    //   bits 0-23   route id
+	    static constexpr uint32_t VALID = 1u << 31;
+	    static constexpr uint32_t EXT = 1u << 30;
+	    static constexpr uint32_t ID_MASK = 0xffffff;
+
+	    static uint32_t depth(uint32_t e) { return (e >> 24) & 0x3f; }
+	    static uint32_t make_entry(uint32_t id, uint32_t len) {
+		return VALID | (len << 24) | id;
+	    }
+	    static uint64_t rule_key(uint32_t net, int len) {
+		return ((uint64_t) net << 6) | (uint64_t) len;
+	    }
+
+	    struct FreeDeleter {
+		void operator()(uint32_t *p) const { std::free(p); }
+	    };
+
+	    void fill(uint32_t net, int len, uint32_t old_entry, uint32_t new_entry, bool replace);
+	    void fill_group(uint32_t group, uint32_t lo, uint32_t count, uint32_t len,
+			    uint32_t old_entry, uint32_t new_entry, bool replace);
+	    void maybe_collapse(uint32_t idx24);
+
+	    std::unique_ptr<uint32_t[], FreeDeleter> m_tbl24;
+	    std::vector<uint32_t> m_tbl8;
+	    std::vector<uint32_t> m_free_groups;
+
+	    std::vector<LpmRoute> m_routes;
+	    std::vector<uint32_t> m_free_ids;
+	    std::unordered_map<uint64_t, uint32_t> m_rules; // prefix -> route id
+	};
+
+	/**
+	 * The smallest set of routes this pass can find that forwards every
+	 * address the same way as `routes`: the longest matching route has
+	 * the same next hop, and no route matches where none did.  Sibling
+	 * prefixes with the same next hop are merged into their parent (two
+	 * /25s into a /24, repeatedly), and routes covered by a less
+	 * specific one with the same next hop are dropped.  Of several
+	 * routes for one prefix the last wins, as in LpmTable, and routes
+	 * with a prefix length outside 0-32 are dropped.  The result is
+	 * sorted by address, then prefix length, with host bits cleared.
+	 */
+	std::vector<StaticRoute> aggregate_routes(const std::vector<StaticRoute> &routes);
+
+	/**
+	 * Same for the config's static routes, keeping lookups the same in
+	 * the LpmTable built from it: interfaces' connected networks are
+	 * never merged into or covered over, and static routes for exactly
+	 * a connected network, which LpmTable ignores, are dropped
+	 */
+	std::vector<StaticRoute> aggregate_routes(const Config &config);
+
+	namespace detail {
+		/**
+		 * Binary trie of prefixes for aggregate_routes.  Each node's
+		 * label says what a lookup ending there finds: a static route's
+		 * next hop, a connected network that must stay as it is, or no
+		 * route.
+		 */
+		class RouteTrie {
+		public:
+		    static constexpr uint64_t NO_LABEL = UINT64_MAX;
+		    static constexpr uint64_t CONNECTED = 1ull << 32;
+
+		    RouteTrie() : m_nodes(1) {}
+
+		    /**
+		     * Label `net`/`len` (host byte order, host bits clear).  A
+		     * static route never replaces a connected network.
+		     */
+		    void insert(uint32_t net, int len, uint64_t label);
+
+		    /**
+		     * Insert static routes in order, skipping bad prefix lengths
+		     */
+		    void insert(const std::vector<StaticRoute> &routes);
+
+		    /**
+		     * Merge siblings, then drop covered routes
+		     */
+		    void aggregate() {
+			merge(0);
+			prune(0, NO_LABEL);
+		    }
+
+		    /**
+		     * Append the remaining static routes to `out`, in order
+		     */
+		    void collect(std::vector<StaticRoute> &out) const { collect(0, 0, 0, out); }
+
+		private:
+		    static constexpr uint32_t NONE = 0;
+
+		    static bool is_static(uint64_t label) { return label < CONNECTED; }
+
+		    struct Node {
+			uint32_t child[2] = {NONE, NONE}; // Node 0 is the root, so never a child
+			uint64_t label = NO_LABEL;
+		    };
+
+		    void merge(uint32_t n);
+		    void prune(uint32_t n, uint64_t inherited);
+		    void collect(uint32_t n, uint32_t net, int len, std::vector<StaticRoute> &out) const;
+
+		    std::vector<Node> m_nodes;
+		};
+	}
+}
+
+inline lnx::LpmTable::LpmTable()
+	: m_tbl24((uint32_t *) std::calloc((size_t) 1 << 24, sizeof(uint32_t))) {
+	if (!m_tbl24) {
+		throw std::bad_alloc();
+	}
+}
+
+inline lnx::LpmTable::LpmTable(const Config &config, const std::vector<StaticRoute> &routes)
+	: LpmTable() {
+	const std::vector<Interface> &ifaces = config.interfaces();
+
+	// Connected networks go in first, so static next hops can be resolved
+	// to an interface by looking them up
+	for (size_t i = 0; i < ifaces.size(); i++) {
+		const Interface &iface = ifaces[i];
+		if (iface.prefix_len < 0 || iface.prefix_len > 32) {
+			continue;
+		}
+		LpmRoute r;
+		r.network_addr = iface.assigned_ip;
+		r.prefix_len = iface.prefix_len;
+		r.next_hop.s_addr = 0;
+		r.ifindex = (int) i;
+		r.connected = true;
+		add(r);
+	}
+
+	// Resolve every next hop before adding any static route, so that one
+	// static covering another's next hop cannot hide the connected network
+	std::vector<int> via_ifindex(routes.size(), -1);
+	for (size_t k = 0; k < routes.size(); k++) {
+		uint32_t via = lookup(routes[k].next_hop);
+		if (via != NO_ROUTE && m_routes[via].connected) {
+			via_ifindex[k] = m_routes[via].ifindex;
+		}
+	}
+
+	for (size_t k = 0; k < routes.size(); k++) {
+		const StaticRoute &s = routes[k];
+		if (s.prefix_len < 0 || s.prefix_len > 32) {
+			continue;
+		}
+		uint32_t mask = s.prefix_len == 0 ? 0 : ~0u << (32 - s.prefix_len);
+		auto it = m_rules.find(rule_key(ntohl(s.network_addr.s_addr) & mask, s.prefix_len));
+		if (it != m_rules.end() && m_routes[it->second].connected) {
+			continue;
+		}
+
+		LpmRoute r;
+		r.network_addr = s.network_addr;
+		r.prefix_len = s.prefix_len;
+		r.next_hop = s.next_hop;
+		r.ifindex = via_ifindex[k];
+		r.connected = false;
+		add(r);
+	}
+}
+
+inline uint32_t lnx::LpmTable::add(const LpmRoute &route) {
+	int len = route.prefix_len;
+	if (len < 0 || len > 32) {
+		return NO_ROUTE;
+	}
+	uint32_t mask = len == 0 ? 0 : ~0u << (32 - len);
+	uint32_t net = ntohl(route.network_addr.s_addr) & mask;
+
+	LpmRoute r = route;
+	r.network_addr.s_addr = htonl(net);
+
+	uint64_t key = rule_key(net, len);
+	auto it = m_rules.find(key);
+	if (it != m_rules.end()) {
+		// Same prefix: the table already points at this id
+		m_routes[it->second] = r;
+		return it->second;
+	}
+
+	uint32_t id;
+	if (!m_free_ids.empty()) {
+		id = m_free_ids.back();
+		m_free_ids.pop_back();
+		m_routes[id] = r;
+	} else {
+		id = (uint32_t) m_routes.size();
+		if (id > ID_MASK) {
+			return NO_ROUTE;
+		}
+		m_routes.push_back(r);
+	}
+	m_rules.emplace(key, id);
+
+	fill(net, len, 0, make_entry(id, (uint32_t) len), false);
+	return id;
+}
+
+inline bool lnx::LpmTable::remove(in_addr network_addr, int len) {
+	if (len < 0 || len > 32) {
+		return false;
+	}
+	uint32_t mask = len == 0 ? 0 : ~0u << (32 - len);
+	uint32_t net = ntohl(network_addr.s_addr) & mask;
+
+	auto it = m_rules.find(rule_key(net, len));
+	if (it == m_rules.end()) {
+		return false;
+	}
+	uint32_t id = it->second;
+	m_rules.erase(it);
+	m_free_ids.push_back(id);
+
+	// Entries that pointed at this route now fall back to the longest
+	// shorter prefix that covers it, if any
+	uint32_t replacement = 0;
+	for (int l = len - 1; l >= 0; l--) {
+		uint32_t m = l == 0 ? 0 : ~0u << (32 - l);
+		auto cover = m_rules.find(rule_key(net & m, l));
+		if (cover != m_rules.end()) {
+			replacement = make_entry(cover->second, (uint32_t) l);
+			break;
+		}
+	}
+
+	fill(net, len, make_entry(id, (uint32_t) len), replacement, true);
+	return true;
+}
+
+/*
+ * Write `new_entry` over the range covered by net/len.  When adding
+ * (replace == false), only entries matched by a prefix no longer than len
+ * are overwritten.  When removing (replace == true), only entries equal to
+ * `old_entry` are.
+ */
+inline void lnx::LpmTable::fill(uint32_t net, int len, uint32_t old_entry,
+				uint32_t new_entry, bool replace) {
+	uint32_t ulen = (uint32_t) len;
+
+	if (len <= 24) {
+		uint32_t lo = net >> 8;
+		uint32_t count = 1u << (24 - len);
+		for (uint32_t i = lo; i < lo + count; i++) {
+			uint32_t e = m_tbl24[i];
+			if (e & EXT) {
+				fill_group(e & ID_MASK, 0, 256, ulen, old_entry, new_entry, replace);
+				if (replace) {
+					maybe_collapse(i);
+				}
+			} else if (replace ? e == old_entry : (!(e & VALID) || depth(e) <= ulen)) {
+				m_tbl24[i] = new_entry;
+			}
+		}
+		return;
+	}
+
+	uint32_t idx24 = net >> 8;
+	uint32_t e = m_tbl24[idx24];
+	if (!(e & EXT)) {
+		if (replace) {
+			return; // Nothing was ever split out for this /24
+		}
+
+		uint32_t group;
+		if (!m_free_groups.empty()) {
+			group = m_free_groups.back();
+			m_free_groups.pop_back();
+		} else {
+			group = (uint32_t) (m_tbl8.size() / 256);
+			m_tbl8.resize(m_tbl8.size() + 256);
+		}
+		std::fill(m_tbl8.begin() + group * 256, m_tbl8.begin() + (group + 1) * 256, e);
+		m_tbl24[idx24] = EXT | group;
+		e = EXT | group;
+	}
+
+	fill_group(e & ID_MASK, net & 0xff, 1u << (32 - len), ulen, old_entry, new_entry, replace);
+	if (replace) {
+		maybe_collapse(idx24);
+	}
+}
+
+inline void lnx::LpmTable::fill_group(uint32_t group, uint32_t lo, uint32_t count, uint32_t len,
+				      uint32_t old_entry, uint32_t new_entry, bool replace) {
+	uint32_t *g = &m_tbl8[group * 256];
+	for (uint32_t j = lo; j < lo + count; j++) {
+		uint32_t e = g[j];
+		if (replace ? e == old_entry : (!(e & VALID) || depth(e) <= len)) {
+			g[j] = new_entry;
+		}
+	}
+}
+
+/*
+ * After a removal, fold a second-level group back into the first level if
+ * all of its entries now come from a single prefix of length <= 24.
+ */
+inline void lnx::LpmTable::maybe_collapse(uint32_t idx24) {
+	uint32_t group = m_tbl24[idx24] & ID_MASK;
+	const uint32_t *g = &m_tbl8[group * 256];
+
+	uint32_t first = g[0];
+	if ((first & VALID) && depth(first) > 24) {
+		return;
+	}
+	for (uint32_t j = 1; j < 256; j++) {
+		if (g[j] != first) {
+			return;
+		}
+	}
+	m_tbl24[idx24] = first;
+	m_free_groups.push_back(group);
+}
+
+inline uint32_t lnx::LpmTable::lookup(in_addr addr) const {
+	uint32_t a = ntohl(addr.s_addr);
+	uint32_t e = m_tbl24[a >> 8];
+	if (e & EXT) {
+		e = m_tbl8[(e & ID_MASK) * 256 + (a & 0xff)];
+	}
+	return (e & VALID) ? (e & ID_MASK) : NO_ROUTE;
+}
+
+inline void lnx::LpmTable::lookup(const in_addr *addrs, size_t n, uint32_t *out) const {
+	const size_t BATCH = 16;
+	uint32_t e24[BATCH];
+
+	for (size_t base = 0; base < n; base += BATCH) {
+		size_t m = std::min(BATCH, n - base);
+
+		for (size_t i = 0; i < m; i++) {
+			__builtin_prefetch(&m_tbl24[ntohl(addrs[base + i].s_addr) >> 8]);
+		}
+		for (size_t i = 0; i < m; i++) {
+			uint32_t a = ntohl(addrs[base + i].s_addr);
+			e24[i] = m_tbl24[a >> 8];
+			if (e24[i] & EXT) {
+				__builtin_prefetch(&m_tbl8[(e24[i] & ID_MASK) * 256 + (a & 0xff)]);
+			}
+		}
+		for (size_t i = 0; i < m; i++) {
+			uint32_t e = e24[i];
+			if (e & EXT) {
+				uint32_t a = ntohl(addrs[base + i].s_addr);
+				e = m_tbl8[(e & ID_MASK) * 256 + (a & 0xff)];
+			}
+			out[base + i] = (e & VALID) ? (e & ID_MASK) : NO_ROUTE;
+		}
+	}
+}
+
+inline void lnx::detail::RouteTrie::insert(uint32_t net, int len, uint64_t label) {
+	uint32_t n = 0;
+	for (int depth = 0; depth < len; depth++) {
+		uint32_t bit = (net >> (31 - depth)) & 1;
+		if (m_nodes[n].child[bit] == NONE) {
+			m_nodes[n].child[bit] = (uint32_t) m_nodes.size();
+			m_nodes.emplace_back();
+		}
+		n = m_nodes[n].child[bit];
+	}
+	if (is_static(label) && !is_static(m_nodes[n].label) && m_nodes[n].label != NO_LABEL) {
+		return;
+	}
+	m_nodes[n].label = label;
+}
+
+// Bottom up: if both halves of a prefix go to the same next hop, so does
+// the whole prefix.  Any route of its own is then never matched, unless
+// it is a connected network, which stays.
+inline void lnx::detail::RouteTrie::merge(uint32_t n) {
+	uint32_t c0 = m_nodes[n].child[0], c1 = m_nodes[n].child[1];
+	if (c0 != NONE) {
+		merge(c0);
+	}
+	if (c1 != NONE) {
+		merge(c1);
+	}
+	if (c0 == NONE || c1 == NONE) {
+		return;
+	}
+	uint64_t l0 = m_nodes[c0].label, l1 = m_nodes[c1].label;
+	uint64_t &own = m_nodes[n].label;
+	if (is_static(l0) && l0 == l1 && (own == NO_LABEL || is_static(own))) {
+		own = l0;
+		m_nodes[c0].label = NO_LABEL;
+		m_nodes[c1].label = NO_LABEL;
+	}
+}
+
+// Top down: a static route with the same next hop as the route it falls
+// back to can go
+inline void lnx::detail::RouteTrie::prune(uint32_t n, uint64_t inherited) {
+	Node &node = m_nodes[n];
+	if (is_static(node.label) && node.label == inherited) {
+		node.label = NO_LABEL;
+	}
+	if (node.label != NO_LABEL) {
+		inherited = node.label;
+	}
+	for (uint32_t c : node.child) {
+		if (c != NONE) {
+			prune(c, inherited);
+		}
+	}
+}
+
+inline void lnx::detail::RouteTrie::collect(uint32_t n, uint32_t net, int len,
+					  std::vector<StaticRoute> &out) const {
+	const Node &node = m_nodes[n];
+	if (is_static(node.label)) {
+		StaticRoute r;
+		r.network_addr.s_addr = htonl(net);
+		r.prefix_len = len;
+		r.next_hop.s_addr = (uint32_t) node.label;
+		out.push_back(r);
+	}
+	for (uint32_t bit = 0; bit < 2; bit++) {
+		if (node.child[bit] != NONE) {
+			collect(node.child[bit], net | (bit << (31 - len)), len + 1, out);
+		}
+	}
+}
+
+inline void lnx::detail::RouteTrie::insert(const std::vector<StaticRoute> &routes) {
+	for (const StaticRoute &s : routes) {
+		if (s.prefix_len < 0 || s.prefix_len > 32) {
+			continue;
+		}
+		uint32_t mask = s.prefix_len == 0 ? 0 : ~0u << (32 - s.prefix_len);
+		insert(ntohl(s.network_addr.s_addr) & mask, s.prefix_len, s.next_hop.s_addr);
+	}
+}
+
+inline std::vector<lnx::StaticRoute> lnx::aggregate_routes(const std::vector<StaticRoute> &routes) {
+	detail::RouteTrie trie;
+	trie.insert(routes);
+	trie.aggregate();
+
+	std::vector<StaticRoute> out;
+	trie.collect(out);
+	return out;
+}
+
+inline std::vector<lnx::StaticRoute> lnx::aggregate_routes(const Config &config) {
+	detail::RouteTrie trie;
+	const std::vector<Interface> &ifaces = config.interfaces();
+	for (size_t i = 0; i < ifaces.size(); i++) {
+		int len = ifaces[i].prefix_len;
+		if (len < 0 || len > 32) {
+			continue;
+		}
+		uint32_t mask = len == 0 ? 0 : ~0u << (32 - len);
+		trie.insert(ntohl(ifaces[i].assigned_ip.s_addr) & mask, len,
+			    detail::RouteTrie::CONNECTED | i);
+	}
+	trie.insert(config.static_routes());
+	trie.aggregate();
+
+	std::vector<StaticRoute> out;
+	trie.collect(out);
+	return out;
+}
+
+#endif // __LNXLPM_H__
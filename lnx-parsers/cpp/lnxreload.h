@@ -0,0 +1,388 @@
+/*
+ * lnxreload.h - Reloading an lnx file while the node is running
+ *
+ * Companion to lnxconfig.h.  lnx::ConfigWatcher holds the current
+ * Config for a file and replaces it whenever the file changes (via
+ * inotify on Linux, or on an explicit reload()), so timing parameters
+ * and static routes can be tuned without a restart.  Build with
+ * -pthread.
+ *
+ * Configs are published RCU-style: readers get the current snapshot
+ * with a single acquire load and never block the writer.  Old snapshots
+ * are freed once every registered reader has passed a quiescent state
+ * (see ConfigWatcher::Reader).
+ */
+
+#ifndef __LNXRELOAD_H__
+#define __LNXRELOAD_H__
+
+#include "lnxconfig.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <poll.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#endif
+
+namespace lnx {
+
+	class ConfigWatcher {
+	    struct Slot;
+
+	public:
+	    class Reader;
+
+	    /**
+	     * Load `path` and start watching it.  If the initial parse
+	     * fails, prints a message and exits the process, like Config's
+	     * constructor.
+	     */
+	    ConfigWatcher(const char *path);
+
+	    /**
+	     * Same as the constructor, but returns nullptr and fills in `err`
+	     * if the initial parse fails or the file cannot be watched.
+	     */
+	    static std::unique_ptr<ConfigWatcher> open(const char *path, ParseError &err);
+
+	    /**
+	     * Stops the watcher thread and frees every snapshot.  All Readers
+	     * must be destroyed first.
+	     */
+	    ~ConfigWatcher();
+
+	    ConfigWatcher(const ConfigWatcher &) = delete;
+	    ConfigWatcher &operator=(const ConfigWatcher &) = delete;
+
+	    /**
+	     * The current snapshot.  The reference stays valid until the
+	     * calling thread's Reader next calls quiescent() or offline().
+	     */
+	    const Config &current() const { return *m_current.load(std::memory_order_acquire); }
+
+	    /**
+	     * Register the calling thread as a reader.  Every thread that
+	     * calls current() needs one for as long as it does so.
+	     */
+	    Reader reader();
+
+	    /**
+	     * Re-parse the file now (e.g. on SIGHUP).  On success the new
+	     * config is published and true is returned.  On a parse error the
+	     * current config is kept, the error is saved in last_error() and
+	     * false is returned.  Safe to call from any thread.
+	     */
+	    bool reload();
+
+	    /**
+	     * Number of configs published so far, starting at 1 for the
+	     * initial load.
+	     */
+	    uint64_t generation() const { return m_epoch.load(std::memory_order_acquire); }
+
+	    /**
+	     * Why the most recent reload failed; lineno is 0 and msg empty if
+	     * it succeeded.
+	     */
+	    ParseError last_error() const;
+
+	    /**
+	     * A reader thread's registration.  Between calls to quiescent(),
+	     * the thread may hold references from current(); calling it says
+	     * it holds none, e.g. once per batch of packets or loop iteration.
+	     * A thread that is about to block for a long time should call
+	     * offline() so it does not hold up freeing old configs, then
+	     * online() before reading again.
+	     *
+	     * These only store to the reader's own slot, so the read path
+	     * itself never touches shared state.
+	     */
+	    class Reader {
+	    public:
+		Reader(Reader &&other) : m_watcher(other.m_watcher), m_slot(other.m_slot) {
+			other.m_slot = nullptr;
+		}
+		Reader(const Reader &) = delete;
+		Reader &operator=(const Reader &) = delete;
+		~Reader();
+
+		const Config &current() const { return m_watcher->current(); }
+
+		void quiescent() {
+			m_slot->seen.store(m_watcher->m_epoch.load(std::memory_order_acquire),
+					   std::memory_order_release);
+		}
+		void offline() { m_slot->seen.store(OFFLINE, std::memory_order_release); }
+
+		void online() {
+			// seq_cst pairs with publish/reclaim: either the writer sees
+			// this store, or this thread's next current() sees the
+			// config the writer just published
+			m_slot->seen.store(m_watcher->m_epoch.load(std::memory_order_seq_cst),
+					   std::memory_order_seq_cst);
+		}
+
+	    private:
+		friend class ConfigWatcher;
+		Reader(ConfigWatcher *watcher, Slot *slot);
+
+		ConfigWatcher *m_watcher;
+		Slot *m_slot;
+	    };
+
+	private:
+	    static constexpr uint64_t OFFLINE = UINT64_MAX;
+	    static constexpr uint64_t UNUSED = UINT64_MAX - 1;
+
+	    /**
+	     * Per-reader epoch: the newest generation the reader has seen
+	     * while quiescent.  One slot per cache line so readers do not
+	     * share lines with each other.
+	     */
+	    struct alignas(64) Slot {
+		std::atomic<uint64_t> seen{UNUSED};
+	    };
+
+	    struct Retired {
+		const Config *config;
+		uint64_t epoch; // Safe to free once every reader has seen this
+	    };
+
+	    ConfigWatcher(const char *path, Config &&initial);
+
+	    // Set up inotify and start the watcher thread.  On failure, closes
+	    // whatever it opened and fills in `err`.
+	    bool start(ParseError &err);
+
+	    void publish(Config &&config);
+	    void reclaim();
+	    void watch();
+
+	    std::string m_path;
+	    std::atomic<const Config *> m_current;
+	    std::atomic<uint64_t> m_epoch{1};
+
+	    // Held while reloading or reclaiming; never by readers
+	    mutable std::mutex m_mutex;
+	    std::vector<std::unique_ptr<Slot>> m_slots;
+	    std::vector<Retired> m_retired;
+	    ParseError m_last_error = {0, ""};
+
+	    int m_inotify_fd = -1;
+	    int m_stop_fd = -1;
+	    std::thread m_thread;
+	};
+}
+
+inline lnx::ConfigWatcher::ConfigWatcher(const char *path)
+	: ConfigWatcher(path, Config(path)) {
+	ParseError err;
+	if (!start(err)) {
+		detail::die(err);
+	}
+}
+
+inline std::unique_ptr<lnx::ConfigWatcher> lnx::ConfigWatcher::open(const char *path,
+								    ParseError &err) {
+	std::optional<Config> c = Config::from_file(path, err);
+	if (!c) {
+		return nullptr;
+	}
+	std::unique_ptr<ConfigWatcher> w(new ConfigWatcher(path, std::move(*c)));
+	if (!w->start(err)) {
+		return nullptr;
+	}
+	return w;
+}
+
+inline lnx::ConfigWatcher::ConfigWatcher(const char *path, Config &&initial)
+	: m_path(path), m_current(new Config(std::move(initial))) {}
+
+inline bool lnx::ConfigWatcher::start(ParseError &err) {
+#ifdef __linux__
+	// Watch the directory rather than the file, since editors and
+	// deploy scripts usually replace the file with a rename.  Creation
+	// alone is not a change: the new file is still empty or partly
+	// written, and IN_CLOSE_WRITE or IN_MOVED_TO follows once complete.
+	std::string dir = ".";
+	size_t slash = m_path.rfind('/');
+	if (slash != std::string::npos) {
+		dir = slash == 0 ? "/" : m_path.substr(0, slash);
+	}
+
+	const char *what = nullptr;
+	m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (m_inotify_fd < 0) {
+		what = "Failed to start inotify: ";
+	} else if ((m_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+		what = "Failed to create eventfd: ";
+	} else if (inotify_add_watch(m_inotify_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		what = "Failed to watch directory: ";
+	}
+	if (what != nullptr) {
+		err.lineno = 0;
+		err.msg = std::string(what) + std::strerror(errno);
+		if (m_inotify_fd >= 0) {
+			close(m_inotify_fd);
+		}
+		if (m_stop_fd >= 0) {
+			close(m_stop_fd);
+		}
+		m_inotify_fd = m_stop_fd = -1;
+		return false;
+	}
+	m_thread = std::thread([this] { watch(); });
+#endif
+	return true;
+}
+
+inline lnx::ConfigWatcher::~ConfigWatcher() {
+#ifdef __linux__
+	// Not started if start() failed
+	if (m_thread.joinable()) {
+		uint64_t one = 1;
+		if (write(m_stop_fd, &one, sizeof(one)) < 0) {
+			perror("write");
+		}
+		m_thread.join();
+		close(m_inotify_fd);
+		close(m_stop_fd);
+	}
+#endif
+	for (Retired &r : m_retired) {
+		delete r.config;
+	}
+	delete m_current.load(std::memory_order_relaxed);
+}
+
+inline lnx::ConfigWatcher::Reader lnx::ConfigWatcher::reader() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	Slot *slot = nullptr;
+	for (auto &s : m_slots) {
+		if (s->seen.load(std::memory_order_relaxed) == UNUSED) {
+			slot = s.get();
+			break;
+		}
+	}
+	if (slot == nullptr) {
+		m_slots.push_back(std::make_unique<Slot>());
+		slot = m_slots.back().get();
+	}
+	return Reader(this, slot);
+}
+
+inline lnx::ConfigWatcher::Reader::Reader(ConfigWatcher *watcher, Slot *slot)
+	: m_watcher(watcher), m_slot(slot) {
+	// Registered readers are online from the start
+	online();
+}
+
+inline lnx::ConfigWatcher::Reader::~Reader() {
+	if (m_slot != nullptr) {
+		m_slot->seen.store(UNUSED, std::memory_order_release);
+	}
+}
+
+inline bool lnx::ConfigWatcher::reload() {
+	ParseError err = {0, ""};
+	std::optional<Config> c = Config::from_file(m_path.c_str(), err);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_last_error = err;
+	if (!c) {
+		return false;
+	}
+	publish(std::move(*c));
+	reclaim();
+	return true;
+}
+
+inline lnx::ParseError lnx::ConfigWatcher::last_error() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_last_error;
+}
+
+// Called with m_mutex held
+inline void lnx::ConfigWatcher::publish(Config &&config) {
+	const Config *old = m_current.exchange(new Config(std::move(config)),
+					       std::memory_order_seq_cst);
+	uint64_t epoch = m_epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+
+	// A reader that quiesces after this point can no longer reach `old`
+	m_retired.push_back({old, epoch});
+}
+
+// Called with m_mutex held
+inline void lnx::ConfigWatcher::reclaim() {
+	uint64_t oldest = OFFLINE;
+	for (auto &s : m_slots) {
+		uint64_t seen = s->seen.load(std::memory_order_seq_cst);
+		if (seen < oldest) {
+			oldest = seen;
+		}
+	}
+
+	size_t kept = 0;
+	for (Retired &r : m_retired) {
+		if (r.epoch <= oldest) {
+			delete r.config;
+		} else {
+			m_retired[kept++] = r;
+		}
+	}
+	m_retired.resize(kept);
+}
+
+inline void lnx::ConfigWatcher::watch() {
+#ifdef __linux__
+	std::string name = m_path.substr(m_path.rfind('/') + 1);
+	alignas(struct inotify_event) char buf[4096];
+
+	for (;;) {
+		bool pending;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			pending = !m_retired.empty();
+		}
+
+		// While old configs are waiting on slow readers, wake up now
+		// and then to retry freeing them
+		struct pollfd fds[2] = {{m_inotify_fd, POLLIN, 0}, {m_stop_fd, POLLIN, 0}};
+		if (poll(fds, 2, pending ? 100 : -1) < 0 && errno != EINTR) {
+			perror("poll");
+			return;
+		}
+		if (fds[1].revents & POLLIN) {
+			return;
+		}
+
+		// Coalesce a burst of events (e.g. write + rename) into one reload
+		bool changed = false;
+		ssize_t n;
+		while ((n = read(m_inotify_fd, buf, sizeof(buf))) > 0) {
+			for (char *p = buf; p < buf + n;) {
+				struct inotify_event *ev = (struct inotify_event *) p;
+				if (ev->len > 0 && name == ev->name) {
+					changed = true;
+				}
+				p += sizeof(struct inotify_event) + ev->len;
+			}
+		}
+
+		if (changed) {
+			reload();
+		} else if (pending) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			reclaim();
+		}
+	}
+#endif
+}
+
+#endif // __LNXRELOAD_H__
@@ -0,0 +1,291 @@
+/*
+ * lnxrip.h - Ready-to-send RIP advertisements
+ *
+ * Companion to lnxconfig.h.  lnx::RIPAdvertiser keeps, for each `rip
+ * advertise-to` neighbor, that neighbor's RIP response messages already
+ * encoded, with split horizon or poisoned reverse applied.  Changing a
+ * route rewrites only its entry in each neighbor's messages, so a
+ * periodic or triggered update is just a send of the stored bytes.
+ *
+ * Messages use the lnx RIP format, all fields in network byte order:
+ *
+ *   uint16_t command;      // 2 for a response
+ *   uint16_t num_entries;  // at most 64
+ *   struct {
+ *       uint32_t cost;     // 16 is infinity
+ *       uint32_t address;
+ *       uint32_t mask;
+ *   } entries[num_entries];
+ */
+
+#ifndef __LNXRIP_H__
+#define __LNXRIP_H__
+
+#include "lnxconfig.h"
+
+#include <sys/uio.h>
+
+namespace lnx {
+
+	static constexpr uint16_t RIP_COMMAND_REQUEST = 1;
+	static constexpr uint16_t RIP_COMMAND_RESPONSE = 2;
+	static constexpr uint32_t RIP_INFINITY = 16;
+	static constexpr size_t RIP_MAX_ENTRIES = 64;
+
+	class RIPAdvertiser {
+	public:
+	    enum class Mode {
+		/**
+		 * Leave a route out of the messages to the neighbor it was
+		 * learned from
+		 */
+		SPLIT_HORIZON,
+
+		/**
+		 * Advertise it back to that neighbor with cost RIP_INFINITY
+		 */
+		POISON_REVERSE,
+	    };
+
+	    /**
+	     * Build messages for each of `conf.rip_neighbors()`, seeded with
+	     * a route of cost 0 for each interface's network, then a route of
+	     * cost 1 via its next hop for each static route.  Routes are
+	     * numbered in that order, so interface i is route i.
+	     */
+	    explicit RIPAdvertiser(const Config &conf, Mode mode = Mode::POISON_REVERSE)
+		: RIPAdvertiser(conf, conf.static_routes(), mode) {}
+
+	    /**
+	     * Same, seeded with `routes` in place of the config's static
+	     * routes, e.g. the smaller set from aggregate_routes(conf)
+	     * (lnxlpm.h)
+	     */
+	    RIPAdvertiser(const Config &conf, const std::vector<StaticRoute> &routes,
+			  Mode mode = Mode::POISON_REVERSE);
+
+	    /**
+	     * Add a route to `network`/`prefix_len` at `cost` (capped at
+	     * RIP_INFINITY), learned from `next_hop` (0.0.0.0 for a local
+	     * route), and return its number
+	     */
+	    uint32_t add_route(in_addr network, int prefix_len, uint32_t cost, in_addr next_hop);
+
+	    /**
+	     * Change a route's cost or next hop.  To withdraw a route, set its
+	     * cost to RIP_INFINITY for a few updates, then remove it.
+	     */
+	    void update_route(uint32_t route, uint32_t cost, in_addr next_hop);
+
+	    /**
+	     * Drop a route from every message.  Its number may be reused by
+	     * a later add_route.  Removing a route that is already removed
+	     * does nothing.
+	     */
+	    void remove_route(uint32_t route);
+
+	    size_t num_neighbors() const { return m_neighbors.size(); }
+
+	    /**
+	     * Number of messages for `neighbor` (an index into
+	     * Config::rip_neighbors()); 0 if it has no entries
+	     */
+	    size_t num_messages(uint32_t neighbor) const;
+
+	    /**
+	     * The `k`-th message for `neighbor`, valid until the next change
+	     * to the routes
+	     */
+	    struct iovec message(uint32_t neighbor, size_t k) const;
+
+	private:
+	    static constexpr uint32_t NONE = UINT32_MAX;
+	    static constexpr size_t HEADER_SIZE = 4;
+	    static constexpr size_t ENTRY_SIZE = 12;
+	    static constexpr size_t MESSAGE_SIZE = HEADER_SIZE + RIP_MAX_ENTRIES * ENTRY_SIZE;
+
+	    struct Route {
+		uint32_t network; // Network byte order
+		uint32_t mask;    // Network byte order
+		uint32_t cost;    // NONE once removed
+		uint32_t from;    // Index of the RIP neighbor it was learned from, or NONE
+	    };
+
+	    /**
+	     * One neighbor's messages, stored back to back at MESSAGE_SIZE
+	     * strides.  Entries are packed: slot s is entry s % 64 of message
+	     * s / 64.
+	     */
+	    struct Neighbor {
+		uint32_t addr;
+		std::vector<uint8_t> buf;
+		std::vector<uint32_t> slot_of;  // Per route, or NONE if left out
+		std::vector<uint32_t> route_of; // Per slot
+	    };
+
+	    uint8_t *entry(Neighbor &n, uint32_t slot);
+	    void set_count(Neighbor &n, size_t message, uint16_t count);
+	    void place(uint32_t route);
+	    void drop(Neighbor &n, uint32_t route);
+	    uint32_t neighbor_index(in_addr addr) const;
+
+	    Mode m_mode;
+	    std::vector<Neighbor> m_neighbors;
+	    detail::FlatIndex m_neighbor_by_addr;
+	    std::vector<Route> m_routes;
+	    std::vector<uint32_t> m_free;
+	};
+}
+
+inline lnx::RIPAdvertiser::RIPAdvertiser(const Config &conf, const std::vector<StaticRoute> &routes,
+					 Mode mode)
+	: m_mode(mode) {
+	const std::vector<RIPNeighbor> &rip = conf.rip_neighbors();
+	m_neighbors.resize(rip.size());
+	m_neighbor_by_addr.reset(rip.size());
+	for (uint32_t i = 0; i < rip.size(); i++) {
+		uint32_t addr = rip[i].dest.s_addr;
+		m_neighbors[i].addr = addr;
+		m_neighbor_by_addr.insert(detail::hash_u32(addr), i, [&](uint32_t pos) {
+			return m_neighbors[pos].addr == addr;
+		});
+	}
+
+	in_addr local = {};
+	for (const Interface &i : conf.interfaces()) {
+		add_route(i.assigned_ip, i.prefix_len, 0, local);
+	}
+	for (const StaticRoute &r : routes) {
+		add_route(r.network_addr, r.prefix_len, 1, r.next_hop);
+	}
+}
+
+inline uint32_t lnx::RIPAdvertiser::add_route(in_addr network, int prefix_len, uint32_t cost,
+					      in_addr next_hop) {
+	uint32_t route;
+	if (!m_free.empty()) {
+		route = m_free.back();
+		m_free.pop_back();
+	} else {
+		route = (uint32_t) m_routes.size();
+		m_routes.push_back({});
+		for (Neighbor &n : m_neighbors) {
+			n.slot_of.push_back(NONE);
+		}
+	}
+
+	uint32_t mask = prefix_len <= 0 ? 0 : htonl(~0u << (32 - std::min(prefix_len, 32)));
+	m_routes[route] = {network.s_addr & mask, mask, std::min(cost, RIP_INFINITY),
+			   neighbor_index(next_hop)};
+	place(route);
+	return route;
+}
+
+inline void lnx::RIPAdvertiser::update_route(uint32_t route, uint32_t cost, in_addr next_hop) {
+	Route &r = m_routes[route];
+	if (r.cost == NONE) {
+		return;
+	}
+	r.cost = std::min(cost, RIP_INFINITY);
+	r.from = neighbor_index(next_hop);
+	place(route);
+}
+
+inline void lnx::RIPAdvertiser::remove_route(uint32_t route) {
+	// Freeing it twice would hand the number to two later add_routes
+	if (m_routes[route].cost == NONE) {
+		return;
+	}
+	for (Neighbor &n : m_neighbors) {
+		drop(n, route);
+	}
+	m_routes[route].cost = NONE;
+	m_free.push_back(route);
+}
+
+inline size_t lnx::RIPAdvertiser::num_messages(uint32_t neighbor) const {
+	return (m_neighbors[neighbor].route_of.size() + RIP_MAX_ENTRIES - 1) / RIP_MAX_ENTRIES;
+}
+
+inline struct iovec lnx::RIPAdvertiser::message(uint32_t neighbor, size_t k) const {
+	const Neighbor &n = m_neighbors[neighbor];
+	size_t entries = std::min(RIP_MAX_ENTRIES, n.route_of.size() - k * RIP_MAX_ENTRIES);
+	return {(void *) (n.buf.data() + k * MESSAGE_SIZE), HEADER_SIZE + entries * ENTRY_SIZE};
+}
+
+inline uint8_t *lnx::RIPAdvertiser::entry(Neighbor &n, uint32_t slot) {
+	return n.buf.data() + (slot / RIP_MAX_ENTRIES) * MESSAGE_SIZE + HEADER_SIZE +
+	       (slot % RIP_MAX_ENTRIES) * ENTRY_SIZE;
+}
+
+inline void lnx::RIPAdvertiser::set_count(Neighbor &n, size_t message, uint16_t count) {
+	uint16_t header[2] = {htons(RIP_COMMAND_RESPONSE), htons(count)};
+	memcpy(n.buf.data() + message * MESSAGE_SIZE, header, sizeof(header));
+}
+
+// Bring every neighbor's entry for `route` in line with the route: write
+// it in place, append it, or take it out under split horizon
+inline void lnx::RIPAdvertiser::place(uint32_t route) {
+	const Route &r = m_routes[route];
+	for (uint32_t i = 0; i < m_neighbors.size(); i++) {
+		Neighbor &n = m_neighbors[i];
+		uint32_t cost = r.cost;
+		if (r.from == i) {
+			if (m_mode == Mode::SPLIT_HORIZON) {
+				drop(n, route);
+				continue;
+			}
+			cost = RIP_INFINITY;
+		}
+
+		uint32_t slot = n.slot_of[route];
+		if (slot == NONE) {
+			slot = (uint32_t) n.route_of.size();
+			if (slot % RIP_MAX_ENTRIES == 0) {
+				n.buf.resize(n.buf.size() + MESSAGE_SIZE);
+			}
+			n.route_of.push_back(route);
+			n.slot_of[route] = slot;
+			set_count(n, slot / RIP_MAX_ENTRIES, slot % RIP_MAX_ENTRIES + 1);
+		}
+
+		uint32_t fields[3] = {htonl(cost), r.network, r.mask};
+		memcpy(entry(n, slot), fields, ENTRY_SIZE);
+	}
+}
+
+// Take `route` out of `n`'s messages by moving the last entry into its
+// slot, so entries stay packed
+inline void lnx::RIPAdvertiser::drop(Neighbor &n, uint32_t route) {
+	uint32_t slot = n.slot_of[route];
+	if (slot == NONE) {
+		return;
+	}
+
+	uint32_t last = (uint32_t) n.route_of.size() - 1;
+	if (slot != last) {
+		uint32_t moved = n.route_of[last];
+		memcpy(entry(n, slot), entry(n, last), ENTRY_SIZE);
+		n.route_of[slot] = moved;
+		n.slot_of[moved] = slot;
+	}
+	n.route_of.pop_back();
+	n.slot_of[route] = NONE;
+
+	if (last % RIP_MAX_ENTRIES == 0) {
+		n.buf.resize(n.buf.size() - MESSAGE_SIZE);
+	} else {
+		set_count(n, last / RIP_MAX_ENTRIES, last % RIP_MAX_ENTRIES);
+	}
+}
+
+inline uint32_t lnx::RIPAdvertiser::neighbor_index(in_addr addr) const {
+	if (addr.s_addr == 0) {
+		return NONE;
+	}
+	return m_neighbor_by_addr.find(detail::hash_u32(addr.s_addr), [&](uint32_t pos) {
+		return m_neighbors[pos].addr == addr.s_addr;
+	});
+}
+
+#endif // __LNXRIP_H__
@@ -0,0 +1,238 @@
+/*
+ * lnxrto.h - TCP retransmission timeouts
+ *
+ * Companion to lnxtimer.h.  lnx::RTOEstimator computes a connection's
+ * retransmission timeout from its round-trip samples (RFC 6298), kept
+ * within the config's `tcp rto-min` and `tcp rto-max`.  lnx::RTOEngine
+ * runs the timers themselves, on one lnx::RTOShard per thread so that
+ * arming timers never contends on a shared lock.  Build with -pthread.
+ *
+ * All times are in microseconds.
+ */
+
+#ifndef __LNXRTO_H__
+#define __LNXRTO_H__
+
+#include "lnxtimer.h"
+
+#include <atomic>
+#include <memory>
+
+namespace lnx {
+
+	/**
+	 * Smoothed RTT estimate and retransmission timeout of one
+	 * connection.  Following Karn's algorithm, only sample segments that
+	 * were not retransmitted.
+	 */
+	class RTOEstimator {
+	public:
+	    /**
+	     * Initial RTO of 1 s (RFC 6298, 2.1), clamped to [min_us, max_us]
+	     */
+	    RTOEstimator(uint64_t min_us, uint64_t max_us, uint64_t granularity_us = 1);
+
+	    explicit RTOEstimator(const Config &conf, uint64_t granularity_us = 1)
+		: RTOEstimator(conf.tcp_rto_min(), conf.tcp_rto_max(), granularity_us) {}
+
+	    /**
+	     * Add a round-trip sample and recompute the RTO
+	     */
+	    void sample(uint64_t rtt_us);
+
+	    /**
+	     * Double the RTO after a timeout, up to the maximum
+	     */
+	    void backoff() { m_rto = std::min(m_rto * 2, m_max); }
+
+	    uint64_t rto() const { return m_rto; }
+
+	    /**
+	     * Smoothed RTT and its variation, both 0 before the first sample
+	     */
+	    uint64_t srtt() const { return m_srtt; }
+	    uint64_t rttvar() const { return m_rttvar; }
+
+	private:
+	    uint64_t m_min;
+	    uint64_t m_max;
+	    uint64_t m_granularity;
+	    uint64_t m_srtt = 0;
+	    uint64_t m_rttvar = 0;
+	    uint64_t m_rto;
+	    bool m_sampled = false;
+	};
+
+	class RTOShard;
+
+	/**
+	 * A connection's retransmission timer and RTT estimate, kept in the
+	 * connection itself.  It belongs to one shard: only that shard's
+	 * thread may arm() or disarm() it, and it may only be destroyed
+	 * there, once disarmed or fired.  Any thread may cancel() it at any
+	 * time without locking.
+	 */
+	class RTOTimer {
+	public:
+	    /**
+	     * `granularity_us` is the clock granularity G of RFC 6298, at
+	     * least the shard's tick
+	     */
+	    explicit RTOTimer(const Config &conf, uint64_t granularity_us = 100)
+		: estimator(conf, granularity_us) {}
+
+	    RTOTimer(const RTOTimer &) = delete;
+	    RTOTimer &operator=(const RTOTimer &) = delete;
+
+	    /**
+	     * Stop the timer from any thread.  Returns true if this prevented
+	     * a timeout, false if the timer was not armed or already fired.
+	     * The owning shard drops the stale wheel entry when it comes due.
+	     */
+	    bool cancel() { return m_armed.exchange(NO_TIMER, std::memory_order_acq_rel) != NO_TIMER; }
+
+	    /**
+	     * Whether a timeout is pending
+	     */
+	    bool armed() const { return m_armed.load(std::memory_order_acquire) != NO_TIMER; }
+
+	    RTOEstimator estimator;
+
+	private:
+	    friend class RTOShard;
+
+	    // The pending wheel entry, or NO_TIMER.  Cleared by cancel(),
+	    // and claimed by the shard when the entry fires.
+	    std::atomic<TimerId> m_armed{NO_TIMER};
+
+	    // The wheel entry as the owner last armed it; only the owner
+	    // touches this
+	    TimerId m_entry = NO_TIMER;
+	};
+
+	/**
+	 * The retransmission timers owned by one thread.  Not thread-safe
+	 * apart from RTOTimer::cancel().
+	 */
+	class alignas(64) RTOShard {
+	public:
+	    /**
+	     * A shard whose time starts at `now_us`, firing timers to within
+	     * `tick_us`
+	     */
+	    explicit RTOShard(uint64_t now_us, uint64_t tick_us = 100) : m_wheel(now_us, tick_us) {}
+
+	    /**
+	     * (Re)start `t`'s timer to go off after its current RTO, e.g. on
+	     * sending new data or after a timeout.  Calls with the timer
+	     * already armed just push it back.
+	     */
+	    void arm(RTOTimer &t);
+
+	    /**
+	     * Stop `t`'s timer and drop its wheel entry now, e.g. once all
+	     * data is acknowledged or before destroying the connection
+	     */
+	    void disarm(RTOTimer &t);
+
+	    /**
+	     * Move time forward to `now_us` and call
+	     * `on_timeout(RTOTimer *const *timers, size_t n)` once with every
+	     * timer that went off and was not cancelled.  Fired timers are
+	     * disarmed; the callback typically retransmits, calls backoff()
+	     * and arms them again.  Returns the number of timeouts.
+	     */
+	    template <typename F>
+	    size_t advance(uint64_t now_us, F &&on_timeout);
+
+	    /**
+	     * Number of wheel entries, including ones cancelled from other
+	     * threads that have not come due yet
+	     */
+	    size_t size() const { return m_wheel.size(); }
+
+	private:
+	    TimerWheel m_wheel;
+	    std::vector<RTOTimer *> m_fired;
+	};
+
+	/**
+	 * One RTOShard per thread, each on its own cache lines.  A connection
+	 * stays on the shard of the thread that handles it; other threads
+	 * only ever cancel() its timer.
+	 */
+	class RTOEngine {
+	public:
+	    RTOEngine(unsigned shards, uint64_t now_us, uint64_t tick_us = 100);
+
+	    size_t num_shards() const { return m_shards.size(); }
+	    RTOShard &shard(unsigned i) { return *m_shards[i]; }
+
+	private:
+	    std::vector<std::unique_ptr<RTOShard>> m_shards;
+	};
+}
+
+inline lnx::RTOEstimator::RTOEstimator(uint64_t min_us, uint64_t max_us, uint64_t granularity_us)
+	: m_min(min_us), m_max(std::max(min_us, max_us)), m_granularity(granularity_us),
+	  m_rto(std::clamp<uint64_t>(1000000, m_min, m_max)) {}
+
+inline void lnx::RTOEstimator::sample(uint64_t rtt_us) {
+	if (!m_sampled) {
+		// RFC 6298, 2.2
+		m_srtt = rtt_us;
+		m_rttvar = rtt_us / 2;
+		m_sampled = true;
+	} else {
+		// RFC 6298, 2.3, with alpha = 1/8 and beta = 1/4
+		uint64_t delta = m_srtt > rtt_us ? m_srtt - rtt_us : rtt_us - m_srtt;
+		m_rttvar = (3 * m_rttvar + delta) / 4;
+		m_srtt = (7 * m_srtt + rtt_us) / 8;
+	}
+	m_rto = std::clamp(m_srtt + std::max(m_granularity, 4 * m_rttvar), m_min, m_max);
+}
+
+inline void lnx::RTOShard::arm(RTOTimer &t) {
+	uint64_t rto = t.estimator.rto();
+	if (t.m_entry == NO_TIMER || !m_wheel.refresh(t.m_entry, rto)) {
+		t.m_entry = m_wheel.add(rto, (uint64_t) (uintptr_t) &t);
+	}
+	t.m_armed.store(t.m_entry, std::memory_order_release);
+}
+
+inline void lnx::RTOShard::disarm(RTOTimer &t) {
+	t.m_armed.store(NO_TIMER, std::memory_order_release);
+	if (t.m_entry != NO_TIMER) {
+		m_wheel.cancel(t.m_entry);
+		t.m_entry = NO_TIMER;
+	}
+}
+
+template <typename F>
+size_t lnx::RTOShard::advance(uint64_t now_us, F &&on_timeout) {
+	m_fired.clear();
+	m_wheel.advance(now_us, [&](const Expiry *timers, size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			RTOTimer *t = (RTOTimer *) (uintptr_t) timers[i].data;
+			t->m_entry = NO_TIMER;
+
+			// Claim the timeout, unless another thread cancelled it first
+			TimerId id = timers[i].id;
+			if (t->m_armed.compare_exchange_strong(id, NO_TIMER, std::memory_order_acq_rel)) {
+				m_fired.push_back(t);
+			}
+		}
+	});
+	if (!m_fired.empty()) {
+		on_timeout(m_fired.data(), m_fired.size());
+	}
+	return m_fired.size();
+}
+
+inline lnx::RTOEngine::RTOEngine(unsigned shards, uint64_t now_us, uint64_t tick_us) {
+	for (unsigned i = 0; i < std::max(1u, shards); i++) {
+		m_shards.push_back(std::make_unique<RTOShard>(now_us, tick_us));
+	}
+}
+
+#endif // __LNXRTO_H__
@@ -0,0 +1,456 @@
+/*
+ * lnxshm.h - Node configs published once in shared memory
+ *
+ * Companion to lnxload.h for emulating many nodes as separate processes
+ * on one host.  Rather than every process parsing its own lnx file into
+ * a private heap copy, one loader parses them all with
+ * lnx::SharedConfigs::publish into a read-only POSIX shared memory
+ * segment, and each node attaches and reads its own entry in place as
+ * an lnx::SharedConfig.  Build with -pthread (and -lrt on glibc older
+ * than 2.34).
+ *
+ * The segment holds only offsets, never pointers, so it can be mapped at
+ * any address:
+ *
+ *   SharedHeader
+ *   SharedEntry[n_nodes]   // sorted by node name
+ *   char names[names_size]
+ *   images                 // one snapshot (detail::SnapshotHeader) per
+ *                          // node, each 8-byte aligned
+ *
+ * As with snapshots, fields are in host byte order, so a segment is only
+ * meant for processes on the machine that published it.
+ */
+
+#ifndef __LNXSHM_H__
+#define __LNXSHM_H__
+
+#include "lnxload.h"
+
+#include <atomic>
+
+namespace lnx {
+
+	namespace detail {
+		constexpr char SHARED_MAGIC[8] = {'L', 'N', 'X', 'S', 'H', 'M', '\0', '\0'};
+		constexpr uint32_t SHARED_VERSION = 1;
+
+		struct SharedHeader {
+			char magic[8];
+			uint32_t version;
+			uint32_t byte_order;
+			uint64_t size;
+			uint32_t n_nodes;
+			uint32_t names_size;
+		};
+
+		struct SharedEntry {
+			uint32_t name_off;
+			uint32_t name_len;
+			uint64_t image_off;
+			uint64_t image_size;
+		};
+
+		static_assert(sizeof(SharedHeader) == 32, "shared segment layout changed");
+		static_assert(sizeof(SharedEntry) == 24, "shared segment layout changed");
+	}
+
+	/**
+	 * One node's config, read in place from an attached segment.  Nothing
+	 * is copied: names are views into the segment, valid for as long as
+	 * the SharedConfigs it came from is attached.  Lookups scan the
+	 * entries, which suits the handful of interfaces and neighbors a node
+	 * has; call to_config() for indexed lookups and the other companions.
+	 */
+	class SharedConfig {
+	public:
+	    RoutingMode routing_mode() const { return (RoutingMode) m_header.routing_mode; }
+	    uint64_t rip_periodic_update_rate() const { return m_header.rip_periodic_update_rate_ms; }
+	    uint64_t rip_timeout_threshold() const { return m_header.rip_timeout_threshold_ms; }
+	    uint64_t tcp_rto_min() const { return m_header.tcp_rto_min_us; }
+	    uint64_t tcp_rto_max() const { return m_header.tcp_rto_max_us; }
+
+	    size_t num_interfaces() const { return m_header.n_interfaces; }
+	    InterfaceView interface(size_t i) const;
+
+	    size_t num_neighbors() const { return m_header.n_neighbors; }
+	    NeighborView neighbor(size_t i) const;
+
+	    size_t num_static_routes() const { return m_header.n_static_routes; }
+	    const StaticRoute *static_routes() const { return m_routes; }
+
+	    size_t num_rip_neighbors() const { return m_header.n_rip_neighbors; }
+	    const RIPNeighbor *rip_neighbors() const { return m_rip; }
+
+	    /**
+	     * Index of the interface called `name`, or -1
+	     */
+	    int interface_index(std::string_view name) const;
+
+	    /**
+	     * Index of the neighbor with virtual IP `addr`, or -1
+	     */
+	    int neighbor_index(in_addr addr) const;
+
+	    /**
+	     * A private heap copy of this config, the same as parsing the
+	     * node's lnx file would give
+	     */
+	    Config to_config() const;
+
+	private:
+	    friend class SharedConfigs;
+
+	    SharedConfig(const char *image, size_t size, const detail::SnapshotHeader &h);
+
+	    std::string_view name_at(uint32_t off, uint32_t len) const {
+		return std::string_view(m_strtab + off, len);
+	    }
+
+	    const char *m_image;
+	    size_t m_size;
+	    detail::SnapshotHeader m_header;
+	    const detail::SnapshotInterface *m_interfaces;
+	    const detail::SnapshotNeighbor *m_neighbors;
+	    const StaticRoute *m_routes;
+	    const RIPNeighbor *m_rip;
+	    const char *m_strtab;
+	};
+
+	/**
+	 * A shared memory segment holding the configs of many nodes, mapped
+	 * read-only.  Move-only; the mapping goes away with it.
+	 */
+	class SharedConfigs {
+	public:
+	    /**
+	     * Parse every file in `paths` on `threads` threads (see
+	     * load_many) and publish them as the shared memory object
+	     * `shm_name` (e.g. "/lnx-net1").  Each node is named after its
+	     * file, without directory or extension: "nets/r1.lnx" is "r1".
+	     * An existing object of that name is replaced; processes still
+	     * attached to it keep the old configs.  Fails without publishing
+	     * anything if any file fails, with the file's path in the message.
+	     */
+	    static bool publish(const char *shm_name, const std::vector<std::string> &paths,
+				ParseError &err, unsigned threads = 0);
+
+	    /**
+	     * Remove the object `shm_name`.  Attached processes are not
+	     * affected.
+	     */
+	    static bool unpublish(const char *shm_name, ParseError &err);
+
+	    /**
+	     * Map the object `shm_name` published by publish()
+	     */
+	    static std::optional<SharedConfigs> attach(const char *shm_name, ParseError &err);
+
+	    SharedConfigs(SharedConfigs &&other);
+	    SharedConfigs &operator=(SharedConfigs &&other);
+	    ~SharedConfigs();
+
+	    size_t size() const { return m_header->n_nodes; }
+
+	    /**
+	     * Name of the `i`-th node, in sorted order
+	     */
+	    std::string_view name(size_t i) const;
+
+	    /**
+	     * The `i`-th node's config.  Only this node's image is checked,
+	     * so a damaged entry fails just its own node.
+	     */
+	    std::optional<SharedConfig> node(size_t i, ParseError &err) const;
+
+	    /**
+	     * The config of the node called `name`, or std::nullopt with
+	     * the reason in `err`
+	     */
+	    std::optional<SharedConfig> find(std::string_view name, ParseError &err) const;
+
+	private:
+	    SharedConfigs(const char *base, size_t size)
+		: m_base(base), m_size(size), m_header((const detail::SharedHeader *) base),
+		  m_entries((const detail::SharedEntry *) (base + sizeof(detail::SharedHeader))) {}
+
+	    static bool fail(ParseError &err, const std::string &msg) {
+		err.lineno = 0;
+		err.msg = msg;
+		return false;
+	    }
+
+	    const char *m_base;
+	    size_t m_size;
+	    const detail::SharedHeader *m_header;
+	    const detail::SharedEntry *m_entries;
+	    const char *m_names = nullptr; // Set once n_nodes is checked
+	};
+}
+
+inline lnx::SharedConfig::SharedConfig(const char *image, size_t size,
+				       const detail::SnapshotHeader &h)
+	: m_image(image), m_size(size), m_header(h) {
+	using namespace detail;
+	const char *p = image + sizeof(SnapshotHeader);
+	m_interfaces = (const SnapshotInterface *) p;
+	p += h.n_interfaces * sizeof(SnapshotInterface);
+	m_neighbors = (const SnapshotNeighbor *) p;
+	p += h.n_neighbors * sizeof(SnapshotNeighbor);
+	m_routes = (const StaticRoute *) p;
+	p += h.n_static_routes * sizeof(StaticRoute);
+	m_rip = (const RIPNeighbor *) p;
+	p += h.n_rip_neighbors * sizeof(RIPNeighbor);
+	m_strtab = p;
+}
+
+inline lnx::InterfaceView lnx::SharedConfig::interface(size_t i) const {
+	const detail::SnapshotInterface &si = m_interfaces[i];
+	return {name_at(si.name_off, si.name_len), si.assigned_ip, si.prefix_len, si.udp_addr,
+		si.udp_port};
+}
+
+inline lnx::NeighborView lnx::SharedConfig::neighbor(size_t i) const {
+	const detail::SnapshotNeighbor &sn = m_neighbors[i];
+	return {sn.dest_addr, sn.udp_addr, sn.udp_port, name_at(sn.ifname_off, sn.ifname_len)};
+}
+
+inline int lnx::SharedConfig::interface_index(std::string_view name) const {
+	for (uint32_t i = 0; i < m_header.n_interfaces; i++) {
+		if (name_at(m_interfaces[i].name_off, m_interfaces[i].name_len) == name) {
+			return (int) i;
+		}
+	}
+	return -1;
+}
+
+inline int lnx::SharedConfig::neighbor_index(in_addr addr) const {
+	for (uint32_t i = 0; i < m_header.n_neighbors; i++) {
+		if (m_neighbors[i].dest_addr.s_addr == addr.s_addr) {
+			return (int) i;
+		}
+	}
+	return -1;
+}
+
+inline lnx::Config lnx::SharedConfig::to_config() const {
+	// The image was checked when this view was made, so this cannot fail
+	ParseError err;
+	return *Config::decode_snapshot(m_image, m_size, nullptr, err);
+}
+
+inline bool lnx::SharedConfigs::publish(const char *shm_name, const std::vector<std::string> &paths,
+					ParseError &err, unsigned threads) {
+	using namespace detail;
+
+	std::vector<LoadResult> loaded = load_many(paths, threads);
+	for (const LoadResult &r : loaded) {
+		if (!r.config) {
+			err = r.error;
+			err.msg = r.path + ": " + err.msg;
+			return false;
+		}
+	}
+
+	struct Node {
+		std::string name;
+		std::string image;
+	};
+	std::vector<Node> nodes(loaded.size());
+	SnapshotSource none = {0, 0, 0};
+	for (size_t i = 0; i < loaded.size(); i++) {
+		nodes[i].name = std::filesystem::path(loaded[i].path).stem().string();
+		nodes[i].image = loaded[i].config->encode_snapshot(none);
+	}
+	std::sort(nodes.begin(), nodes.end(), [](const Node &a, const Node &b) {
+		return a.name < b.name;
+	});
+	for (size_t i = 1; i < nodes.size(); i++) {
+		if (nodes[i].name == nodes[i - 1].name) {
+			return fail(err, "Duplicate node name: " + nodes[i].name);
+		}
+	}
+
+	// Lay out the segment
+	SharedHeader h;
+	std::memset(&h, 0, sizeof(h));
+	h.version = SHARED_VERSION;
+	h.byte_order = SNAPSHOT_BYTE_ORDER;
+	h.n_nodes = (uint32_t) nodes.size();
+
+	std::vector<SharedEntry> entries(nodes.size());
+	std::string names;
+	for (size_t i = 0; i < nodes.size(); i++) {
+		entries[i].name_off = (uint32_t) names.size();
+		entries[i].name_len = (uint32_t) nodes[i].name.size();
+		names += nodes[i].name;
+	}
+	h.names_size = (uint32_t) names.size();
+
+	uint64_t off = sizeof(h) + entries.size() * sizeof(SharedEntry) + names.size();
+	for (size_t i = 0; i < nodes.size(); i++) {
+		off = (off + 7) & ~(uint64_t) 7;
+		entries[i].image_off = off;
+		entries[i].image_size = nodes[i].image.size();
+		off += nodes[i].image.size();
+	}
+	h.size = off;
+
+	// shm_open has no rename, so the new object is filled in under its
+	// final name and only marked valid, by writing the magic, once
+	// complete.  Attaching in between fails rather than reading half a
+	// segment.
+	shm_unlink(shm_name);
+	int fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0) {
+		return fail(err, std::string("Failed to create shared memory: ") + std::strerror(errno));
+	}
+	if (ftruncate(fd, (off_t) h.size) < 0) {
+		fail(err, std::string("Failed to size shared memory: ") + std::strerror(errno));
+		close(fd);
+		shm_unlink(shm_name);
+		return false;
+	}
+	void *mem = mmap(nullptr, h.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) {
+		fail(err, std::string("Failed to map shared memory: ") + std::strerror(errno));
+		shm_unlink(shm_name);
+		return false;
+	}
+
+	char *base = (char *) mem;
+	std::memcpy(base, &h, sizeof(h));
+	std::memcpy(base + sizeof(h), entries.data(), entries.size() * sizeof(SharedEntry));
+	std::memcpy(base + sizeof(h) + entries.size() * sizeof(SharedEntry), names.data(), names.size());
+	for (size_t i = 0; i < nodes.size(); i++) {
+		std::memcpy(base + entries[i].image_off, nodes[i].image.data(), nodes[i].image.size());
+	}
+	std::atomic_thread_fence(std::memory_order_release);
+	std::memcpy(base, SHARED_MAGIC, sizeof(SHARED_MAGIC));
+	munmap(mem, h.size);
+	return true;
+}
+
+inline bool lnx::SharedConfigs::unpublish(const char *shm_name, ParseError &err) {
+	if (shm_unlink(shm_name) < 0) {
+		return fail(err, std::string("Failed to remove shared memory: ") + std::strerror(errno));
+	}
+	return true;
+}
+
+inline std::optional<lnx::SharedConfigs> lnx::SharedConfigs::attach(const char *shm_name,
+								     ParseError &err) {
+	using namespace detail;
+
+	int fd = shm_open(shm_name, O_RDONLY, 0);
+	if (fd < 0) {
+		fail(err, std::string("Failed to open shared memory: ") + std::strerror(errno));
+		return std::nullopt;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		fail(err, std::string("Failed to open shared memory: ") + std::strerror(errno));
+		close(fd);
+		return std::nullopt;
+	}
+	size_t size = (size_t) st.st_size;
+	if (size < sizeof(SharedHeader)) {
+		close(fd);
+		fail(err, "Shared configs not published yet");
+		return std::nullopt;
+	}
+	void *mem = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) {
+		fail(err, std::string("Failed to map shared memory: ") + std::strerror(errno));
+		return std::nullopt;
+	}
+
+	// From here on the destructor unmaps on failure
+	SharedConfigs s((const char *) mem, size);
+	const SharedHeader &h = *s.m_header;
+	if (std::memcmp(h.magic, SHARED_MAGIC, sizeof(h.magic)) != 0) {
+		fail(err, "Shared configs not published yet");
+		return std::nullopt;
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (h.version != SHARED_VERSION || h.byte_order != SNAPSHOT_BYTE_ORDER || h.size != size ||
+	    sizeof(h) + (uint64_t) h.n_nodes * sizeof(SharedEntry) + h.names_size > size) {
+		fail(err, "Invalid shared configs");
+		return std::nullopt;
+	}
+	for (uint32_t i = 0; i < h.n_nodes; i++) {
+		const SharedEntry &e = s.m_entries[i];
+		if (e.name_off > h.names_size || e.name_len > h.names_size - e.name_off ||
+		    e.image_off % 8 != 0 || e.image_off > size || e.image_size > size - e.image_off) {
+			fail(err, "Invalid shared configs");
+			return std::nullopt;
+		}
+	}
+	s.m_names = (const char *) (s.m_entries + h.n_nodes);
+	return s;
+}
+
+inline lnx::SharedConfigs::SharedConfigs(SharedConfigs &&other)
+	: m_base(other.m_base), m_size(other.m_size), m_header(other.m_header),
+	  m_entries(other.m_entries), m_names(other.m_names) {
+	other.m_base = nullptr;
+}
+
+inline lnx::SharedConfigs &lnx::SharedConfigs::operator=(SharedConfigs &&other) {
+	if (this != &other) {
+		if (m_base != nullptr) {
+			munmap((void *) m_base, m_size);
+		}
+		m_base = other.m_base;
+		m_size = other.m_size;
+		m_header = other.m_header;
+		m_entries = other.m_entries;
+		m_names = other.m_names;
+		other.m_base = nullptr;
+	}
+	return *this;
+}
+
+inline lnx::SharedConfigs::~SharedConfigs() {
+	if (m_base != nullptr) {
+		munmap((void *) m_base, m_size);
+	}
+}
+
+inline std::string_view lnx::SharedConfigs::name(size_t i) const {
+	return std::string_view(m_names + m_entries[i].name_off, m_entries[i].name_len);
+}
+
+inline std::optional<lnx::SharedConfig> lnx::SharedConfigs::node(size_t i, ParseError &err) const {
+	const detail::SharedEntry &e = m_entries[i];
+	const char *image = m_base + e.image_off;
+	detail::SnapshotHeader h;
+	if (!detail::check_snapshot(image, e.image_size, h, err)) {
+		err.msg = "Node " + std::string(name(i)) + ": " + err.msg;
+		return std::nullopt;
+	}
+	return SharedConfig(image, e.image_size, h);
+}
+
+inline std::optional<lnx::SharedConfig> lnx::SharedConfigs::find(std::string_view name,
+								 ParseError &err) const {
+	size_t lo = 0, hi = size();
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		std::string_view n = this->name(mid);
+		if (n == name) {
+			return node(mid, err);
+		}
+		if (n < name) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	fail(err, "No such node: " + std::string(name));
+	return std::nullopt;
+}
+
+#endif // __LNXSHM_H__
@@ -0,0 +1,364 @@
+/*
+ * lnxsock.h - Opening the UDP sockets of a node's interfaces
+ *
+ * Companion to lnxconfig.h.  lnx::InterfaceSockets binds one UDP socket
+ * per interface of a Config, at its udp_addr and udp_port, with options
+ * suited to moving a lot of packets, and registers them all with one
+ * epoll set.  lnx::SendBatch queues frames to neighbors and sends them
+ * with one sendmmsg per interface.  Linux only.
+ */
+
+#ifndef __LNXSOCK_H__
+#define __LNXSOCK_H__
+
+#include "lnxconfig.h"
+
+#ifndef __linux__
+#error "lnxsock.h needs Linux (epoll)"
+#endif
+
+#include <algorithm>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+namespace lnx {
+
+	struct SocketOptions {
+		/**
+		 * SO_RCVBUF and SO_SNDBUF for each socket, in bytes, or 0 to
+		 * keep the system default.  The kernel caps these at
+		 * net.core.rmem_max and wmem_max.
+		 */
+		int rcvbuf = 4 << 20;
+		int sndbuf = 4 << 20;
+
+		/**
+		 * Set SO_REUSEPORT, so that several processes or threads can
+		 * each bind the same endpoints and share the load
+		 */
+		bool reuseport = false;
+
+		/**
+		 * Set IP_PKTINFO, so that recvmsg/recvmmsg report each
+		 * packet's destination address in an IP_PKTINFO control message
+		 */
+		bool pktinfo = true;
+
+		/**
+		 * Events each socket is registered for
+		 */
+		uint32_t events = EPOLLIN;
+	};
+
+	/**
+	 * The bound sockets of every interface in a Config, in the same order
+	 * as Config::interfaces().  Sockets are non-blocking and close-on-exec.
+	 * Each is registered with epoll_fd() with its ifindex as the event's
+	 * `data.u32`, so a receive loop looks like:
+	 *
+	 *   struct epoll_event evs[16];
+	 *   int n = epoll_wait(socks.epoll_fd(), evs, 16, -1);
+	 *   for (int i = 0; i < n; i++) {
+	 *       int ifindex = evs[i].data.u32;
+	 *       recvmmsg(socks.fd(ifindex), ...);
+	 *   }
+	 */
+	class InterfaceSockets {
+	public:
+	    /**
+	     * Open and bind a socket for each of `conf`'s interfaces.  On any
+	     * error, prints a message and exits the process, like Config's
+	     * constructor.
+	     */
+	    explicit InterfaceSockets(const Config &conf, const SocketOptions &opts = {});
+
+	    /**
+	     * Same as the constructor, but returns std::nullopt and describes
+	     * the failure in `err` (with lineno 0).  Sockets opened before the
+	     * failure are closed.
+	     */
+	    static std::optional<InterfaceSockets> open(const Config &conf, ParseError &err,
+							const SocketOptions &opts = {});
+
+	    InterfaceSockets(InterfaceSockets &&other);
+	    InterfaceSockets(const InterfaceSockets &) = delete;
+	    InterfaceSockets &operator=(const InterfaceSockets &) = delete;
+
+	    /**
+	     * Closes every socket and the epoll set
+	     */
+	    ~InterfaceSockets();
+
+	    size_t size() const { return m_fds.size(); }
+
+	    /**
+	     * Socket of interface `ifindex`
+	     */
+	    int fd(int ifindex) const { return m_fds[ifindex]; }
+
+	    /**
+	     * All sockets, indexed by ifindex
+	     */
+	    const std::vector<int> &fds() const { return m_fds; }
+
+	    int epoll_fd() const { return m_epoll_fd; }
+
+	private:
+	    InterfaceSockets() = default;
+
+	    bool bring_up(const Config &conf, const SocketOptions &opts, ParseError &err);
+	    void close_all();
+
+	    std::vector<int> m_fds;
+	    int m_epoll_fd = -1;
+	};
+
+	/**
+	 * Outgoing frames grouped by interface.  add() queues a frame for a
+	 * neighbor on that neighbor's interface; flush() sends each
+	 * interface's queue with a single sendmmsg, addressed through
+	 * Neighbor::udp_sockaddr.
+	 *
+	 * Frames are not copied: their data, and the Config and
+	 * InterfaceSockets the batch was built from, must stay valid until
+	 * the next flush().  A batch is meant for one thread.
+	 */
+	class SendBatch {
+	public:
+	    /**
+	     * Queue up to `per_interface` frames per interface between
+	     * flushes (sendmmsg sends at most UIO_MAXIOV at once)
+	     */
+	    SendBatch(const Config &conf, const InterfaceSockets &socks, size_t per_interface = 64);
+
+	    SendBatch(const SendBatch &) = delete;
+	    SendBatch &operator=(const SendBatch &) = delete;
+
+	    /**
+	     * Queue `len` bytes at `data` for neighbor `neighbor` (an index
+	     * into Config::neighbors()).  If its interface's queue is full,
+	     * that queue is flushed first.  Returns false, queueing nothing,
+	     * if the neighbor's interface does not exist.
+	     */
+	    bool add(uint32_t neighbor, const void *data, size_t len);
+
+	    /**
+	     * Send every queued frame.  Returns the number sent since the
+	     * last flush, including any that add() sent to make room; frames
+	     * the kernel refused (e.g. a full socket buffer, since sockets are
+	     * non-blocking) are dropped and counted in dropped(), like a
+	     * congested link.
+	     */
+	    size_t flush();
+
+	    /**
+	     * Number of frames queued since the last flush
+	     */
+	    size_t pending() const { return m_pending; }
+
+	    /**
+	     * Total frames dropped by flushes so far
+	     */
+	    uint64_t dropped() const { return m_dropped; }
+
+	private:
+	    // Flush interface `ifindex`'s queue
+	    size_t flush_interface(uint32_t ifindex);
+
+	    const Config &m_conf;
+	    const InterfaceSockets &m_socks;
+	    size_t m_cap;
+
+	    // Queue i is entries [i * m_cap, i * m_cap + m_count[i])
+	    std::vector<struct mmsghdr> m_msgs;
+	    std::vector<struct iovec> m_iovs;
+	    std::vector<uint32_t> m_count;
+
+	    // Interfaces with a non-empty queue, so flush() only visits those
+	    std::vector<uint32_t> m_active;
+
+	    size_t m_pending = 0;
+	    size_t m_sent_since_flush = 0; // By add() making room
+	    uint64_t m_dropped = 0;
+	};
+}
+
+inline lnx::InterfaceSockets::InterfaceSockets(const Config &conf, const SocketOptions &opts) {
+	ParseError err = {0, ""};
+	if (!bring_up(conf, opts, err)) {
+		std::cerr << err.msg << std::endl;
+		std::exit(1);
+	}
+}
+
+inline std::optional<lnx::InterfaceSockets> lnx::InterfaceSockets::open(const Config &conf,
+									  ParseError &err,
+									  const SocketOptions &opts) {
+	InterfaceSockets s;
+	if (!s.bring_up(conf, opts, err)) {
+		return std::nullopt;
+	}
+	return s;
+}
+
+inline lnx::InterfaceSockets::InterfaceSockets(InterfaceSockets &&other)
+	: m_fds(std::move(other.m_fds)), m_epoll_fd(other.m_epoll_fd) {
+	other.m_fds.clear();
+	other.m_epoll_fd = -1;
+}
+
+inline lnx::InterfaceSockets::~InterfaceSockets() {
+	close_all();
+}
+
+inline void lnx::InterfaceSockets::close_all() {
+	for (int fd : m_fds) {
+		close(fd);
+	}
+	m_fds.clear();
+	if (m_epoll_fd >= 0) {
+		close(m_epoll_fd);
+		m_epoll_fd = -1;
+	}
+}
+
+inline bool lnx::InterfaceSockets::bring_up(const Config &conf, const SocketOptions &opts,
+					     ParseError &err) {
+	auto fail = [&](const Interface *i, const char *what) {
+		int saved = errno;
+		err.lineno = 0;
+		err.msg = (i != nullptr ? i->name + ": " : std::string()) + what;
+		if (i != nullptr) {
+			err.msg += " " + detail::endpoint_str(i->udp_addr, i->udp_port);
+		}
+		err.msg += std::string(": ") + strerror(saved);
+		close_all();
+		return false;
+	};
+
+	m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (m_epoll_fd < 0) {
+		return fail(nullptr, "epoll_create1");
+	}
+
+	int one = 1;
+	m_fds.reserve(conf.interfaces().size());
+	for (const Interface &i : conf.interfaces()) {
+		int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (fd < 0) {
+			return fail(&i, "socket");
+		}
+		m_fds.push_back(fd);
+
+		if ((opts.rcvbuf > 0 &&
+		     setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &opts.rcvbuf, sizeof(opts.rcvbuf)) < 0) ||
+		    (opts.sndbuf > 0 &&
+		     setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &opts.sndbuf, sizeof(opts.sndbuf)) < 0) ||
+		    (opts.reuseport &&
+		     setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) ||
+		    (opts.pktinfo &&
+		     setsockopt(fd, IPPROTO_IP, IP_PKTINFO, &one, sizeof(one)) < 0)) {
+			return fail(&i, "setsockopt");
+		}
+
+		struct sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_addr = i.udp_addr;
+		addr.sin_port = htons(i.udp_port);
+		if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+			return fail(&i, "bind");
+		}
+
+		struct epoll_event ev = {};
+		ev.events = opts.events;
+		ev.data.u32 = (uint32_t) (m_fds.size() - 1);
+		if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			return fail(&i, "epoll_ctl");
+		}
+	}
+	return true;
+}
+
+inline lnx::SendBatch::SendBatch(const Config &conf, const InterfaceSockets &socks,
+				size_t per_interface)
+	: m_conf(conf), m_socks(socks),
+	  m_cap(std::max<size_t>(1, std::min<size_t>(per_interface, UIO_MAXIOV))),
+	  m_msgs(conf.interfaces().size() * m_cap), m_iovs(m_msgs.size()),
+	  m_count(conf.interfaces().size(), 0) {
+	// Each message always points at its own iovec, so add() only has
+	// to fill in the address and buffer
+	for (size_t k = 0; k < m_msgs.size(); k++) {
+		struct msghdr &h = m_msgs[k].msg_hdr;
+		h.msg_namelen = sizeof(sockaddr_in);
+		h.msg_iov = &m_iovs[k];
+		h.msg_iovlen = 1;
+	}
+	m_active.reserve(m_count.size());
+}
+
+inline bool lnx::SendBatch::add(uint32_t neighbor, const void *data, size_t len) {
+	const Neighbor &nb = m_conf.neighbors()[neighbor];
+	if (nb.ifindex < 0 || (size_t) nb.ifindex >= m_count.size()) {
+		return false;
+	}
+
+	uint32_t i = (uint32_t) nb.ifindex;
+	if (m_count[i] == m_cap) {
+		// Still in m_active, so flush() will get to what comes next
+		m_sent_since_flush += flush_interface(i);
+	} else if (m_count[i] == 0) {
+		m_active.push_back(i);
+	}
+
+	size_t k = i * m_cap + m_count[i]++;
+	m_msgs[k].msg_hdr.msg_name = (void *) &nb.udp_sockaddr;
+	m_iovs[k].iov_base = (void *) data;
+	m_iovs[k].iov_len = len;
+	m_pending++;
+	return true;
+}
+
+inline size_t lnx::SendBatch::flush() {
+	size_t sent = m_sent_since_flush;
+	for (uint32_t i : m_active) {
+		sent += flush_interface(i);
+	}
+	m_active.clear();
+	m_sent_since_flush = 0;
+	return sent;
+}
+
+// Leaves `ifindex` in m_active; the caller either clears m_active or
+// is about to queue on it again, and must not add it a second time
+inline size_t lnx::SendBatch::flush_interface(uint32_t ifindex) {
+	struct mmsghdr *msgs = &m_msgs[ifindex * m_cap];
+	uint32_t n = m_count[ifindex];
+	uint32_t done = 0;
+	size_t sent = 0;
+
+	while (done < n) {
+		int r = sendmmsg(m_socks.fd((int) ifindex), msgs + done, n - done, 0);
+		if (r > 0) {
+			done += r;
+			sent += r;
+		} else if (r < 0 && errno == EINTR) {
+			continue;
+		} else if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)) {
+			// The socket buffer is full, so the rest would fail too
+			m_dropped += n - done;
+			break;
+		} else {
+			// The frame at `done` failed; drop it and carry on with the rest
+			done++;
+			m_dropped++;
+		}
+	}
+
+	m_pending -= n;
+	m_count[ifindex] = 0;
+	return sent;
+}
+
+#endif // __LNXSOCK_H__
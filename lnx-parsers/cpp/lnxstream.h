@@ -0,0 +1,258 @@
+/*
+ * lnxstream.h - Parsing an lnx file as it arrives
+ *
+ * Companion to lnxconfig.h for configs pushed over a pipe or socket
+ * rather than read from a file.  lnx::StreamParser takes the input in
+ * arbitrary chunks, parses each complete line as soon as its newline
+ * arrives and only buffers the unfinished last line, so memory stays
+ * bounded by the longest line.  lnx::ConfigStream builds a Config the
+ * same way.
+ */
+
+#ifndef __LNXSTREAM_H__
+#define __LNXSTREAM_H__
+
+#include "lnxconfig.h"
+
+namespace lnx {
+
+	/**
+	 * Result of StreamParser::read_from
+	 */
+	enum class StreamStatus {
+		/**
+		 * The descriptor has no more data for now (EAGAIN); wait for it
+		 * to be readable again
+		 */
+		AGAIN,
+
+		/**
+		 * End of input was reached and the whole stream parsed
+		 */
+		DONE,
+
+		/**
+		 * A line failed to parse, or reading failed; see error()
+		 */
+		FAILED,
+	};
+
+	/**
+	 * Push-style version of lnx::parse: calls `visitor` for each
+	 * directive as lines complete, with the same grammar and line
+	 * numbers as parsing the whole text at once.
+	 */
+	template <typename V>
+	class StreamParser {
+	public:
+	    static constexpr size_t DEFAULT_MAX_LINE = 4096;
+
+	    /**
+	     * Lines longer than `max_line` bytes are rejected, which bounds
+	     * the buffering for a peer that never sends a newline
+	     */
+	    explicit StreamParser(V &visitor, size_t max_line = DEFAULT_MAX_LINE)
+		: m_visitor(visitor), m_max_line(max_line) {}
+
+	    /**
+	     * Parse the next `len` bytes of input.  Returns false once any
+	     * line has failed (then and on every later call), with the
+	     * problem in error().
+	     */
+	    bool feed(const char *data, size_t len);
+
+	    /**
+	     * Signal the end of input, parsing a last line that has no
+	     * newline.  Returns false if it, or any earlier line, failed.
+	     */
+	    bool finish();
+
+	    /**
+	     * Read everything available from non-blocking `fd` and feed it,
+	     * calling finish() at end of file.  Meant to be called each time
+	     * epoll reports the descriptor readable.
+	     */
+	    StreamStatus read_from(int fd);
+
+	    bool failed() const { return m_failed; }
+	    const ParseError &error() const { return m_err; }
+
+	    /**
+	     * Number of lines completed so far
+	     */
+	    int lineno() const { return m_lineno; }
+
+	    /**
+	     * Bytes of an unfinished line held back until its newline
+	     */
+	    size_t buffered() const { return m_partial.size(); }
+
+	private:
+	    bool line(const char *begin, const char *end, const char *limit);
+	    bool too_long();
+
+	    V &m_visitor;
+	    size_t m_max_line;
+	    std::string m_partial;
+	    int m_lineno = 0;
+	    bool m_failed = false;
+	    ParseError m_err = {0, ""};
+	};
+
+	/**
+	 * Builds a Config from a stream, like Config::from_string on the
+	 * concatenation of every chunk fed to it.
+	 */
+	class ConfigStream {
+	public:
+	    explicit ConfigStream(size_t max_line = StreamParser<Config::Builder>::DEFAULT_MAX_LINE)
+		: m_builder(m_config), m_parser(m_builder, max_line) {}
+
+	    ConfigStream(const ConfigStream &) = delete;
+	    ConfigStream &operator=(const ConfigStream &) = delete;
+
+	    bool feed(const char *data, size_t len);
+	    StreamStatus read_from(int fd);
+
+	    /**
+	     * Finish the stream and return the config, or std::nullopt with
+	     * the first bad line in `err`.  The stream is used up either way.
+	     */
+	    std::optional<Config> finish(ParseError &err);
+
+	    const ParseError &error() const { return m_parser.error(); }
+
+	private:
+	    Config m_config;
+	    Config::Builder m_builder;
+	    StreamParser<Config::Builder> m_parser;
+	};
+}
+
+template <typename V>
+bool lnx::StreamParser<V>::feed(const char *data, size_t len) {
+	if (m_failed) {
+		return false;
+	}
+	LNX_STATS_TIME(parse_cycles);
+	LNX_STATS_ADD(bytes_read, len);
+	const char *p = data;
+	const char *end = data + len;
+
+	// Complete the line left over from the previous chunk.  It is
+	// scanned in m_partial, which ends at its newline.
+	if (!m_partial.empty()) {
+		const char *eol = (const char *) memchr(p, '\n', end - p);
+		if (eol == nullptr) {
+			m_partial.append(p, end - p);
+			return m_partial.size() <= m_max_line || too_long();
+		}
+		m_partial.append(p, eol + 1 - p);
+		p = eol + 1;
+		if (m_partial.size() - 1 > m_max_line) {
+			return too_long();
+		}
+		const char *b = m_partial.data();
+		bool ok = line(b, b + m_partial.size() - 1, b + m_partial.size());
+		m_partial.clear();
+		if (!ok) {
+			return false;
+		}
+	}
+
+	// Whole lines within this chunk are scanned in place
+	while (p < end) {
+		const char *eol = (const char *) memchr(p, '\n', end - p);
+		if (eol == nullptr) {
+			if ((size_t) (end - p) > m_max_line) {
+				return too_long();
+			}
+			m_partial.assign(p, end - p);
+			break;
+		}
+		if (!line(p, eol, end)) {
+			return false;
+		}
+		p = eol + 1;
+	}
+	return true;
+}
+
+template <typename V>
+bool lnx::StreamParser<V>::finish() {
+	if (m_failed) {
+		return false;
+	}
+	LNX_STATS_TIME(parse_cycles);
+	if (!m_partial.empty()) {
+		const char *b = m_partial.data();
+		bool ok = line(b, b + m_partial.size(), b + m_partial.size());
+		m_partial.clear();
+		return ok;
+	}
+	return true;
+}
+
+template <typename V>
+lnx::StreamStatus lnx::StreamParser<V>::read_from(int fd) {
+	char buf[65536];
+	for (;;) {
+		ssize_t n = read(fd, buf, sizeof(buf));
+		if (n > 0) {
+			if (!feed(buf, n)) {
+				return StreamStatus::FAILED;
+			}
+		} else if (n == 0) {
+			return finish() ? StreamStatus::DONE : StreamStatus::FAILED;
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return StreamStatus::AGAIN;
+		} else if (errno != EINTR) {
+			m_failed = true;
+			m_err.lineno = 0;
+			m_err.msg = std::string("Failed to read: ") + std::strerror(errno);
+			return StreamStatus::FAILED;
+		}
+	}
+}
+
+// Parse one line.  As for detail::parse_line, `end` is either at a
+// newline or equal to `limit`.
+template <typename V>
+bool lnx::StreamParser<V>::line(const char *begin, const char *end, const char *limit) {
+	m_lineno++;
+	LNX_STATS_ADD(lines, 1);
+	if (!detail::parse_line(begin, end, limit, m_lineno, m_visitor, m_err)) {
+		m_failed = true;
+		return false;
+	}
+	return true;
+}
+
+template <typename V>
+bool lnx::StreamParser<V>::too_long() {
+	m_failed = true;
+	m_partial.clear();
+	return detail::fail(m_err, "Line too long", m_lineno + 1);
+}
+
+inline bool lnx::ConfigStream::feed(const char *data, size_t len) {
+	LNX_STATS_SCOPE(m_config.m_stats);
+	return m_parser.feed(data, len);
+}
+
+inline lnx::StreamStatus lnx::ConfigStream::read_from(int fd) {
+	LNX_STATS_SCOPE(m_config.m_stats);
+	return m_parser.read_from(fd);
+}
+
+inline std::optional<lnx::Config> lnx::ConfigStream::finish(ParseError &err) {
+	LNX_STATS_SCOPE(m_config.m_stats);
+	if (!m_parser.finish()) {
+		err = m_parser.error();
+		return std::nullopt;
+	}
+	m_config.finish();
+	return std::move(m_config);
+}
+
+#endif // __LNXSTREAM_H__
@@ -0,0 +1,434 @@
+/*
+ * lnxtimer.h - Timers for RIP updates and route expiry
+ *
+ * Companion to lnxconfig.h.  lnx::TimerWheel is a hierarchical timing
+ * wheel: adding, cancelling and refreshing a timer are O(1) no matter
+ * how many are pending, so a router can keep one timeout per learned
+ * route instead of rescanning a route table.  lnx::RIPTimers sets one up
+ * from a Config's RIP parameters.
+ *
+ * Nothing here reads the clock or spawns threads; the caller's event
+ * loop passes in the current time (e.g. CLOCK_MONOTONIC in ms).  The
+ * wheel itself works in whatever unit the caller uses consistently.
+ */
+
+#ifndef __LNXTIMER_H__
+#define __LNXTIMER_H__
+
+#include "lnxconfig.h"
+
+#include <algorithm>
+#include <random>
+
+namespace lnx {
+
+	/**
+	 * Handle for a timer.  Handles of fired or cancelled timers are not
+	 * handed out again (until 2^32 more timers have used the same
+	 * slot), so cancelling one is a harmless no-op.
+	 */
+	using TimerId = uint64_t;
+
+	static constexpr TimerId NO_TIMER = 0;
+
+	/**
+	 * One timer that came due, as passed to an expiry callback
+	 */
+	struct Expiry {
+		TimerId id;
+		uint64_t data;
+	};
+
+	/**
+	 * Timers with `tick_len` resolution, in four levels of 256 slots (the
+	 * first covers the next 256 ticks, the next the next 65536, and so
+	 * on).  Timers cascade down a level as their time comes closer, so
+	 * each is touched at most four times before firing.  Timers never
+	 * fire early, and fire at most one tick late.
+	 *
+	 * Not thread-safe.
+	 */
+	class TimerWheel {
+	public:
+	    /**
+	     * A wheel whose time starts at `now`.  `seed` drives the
+	     * jitter of periodic timers.
+	     */
+	    explicit TimerWheel(uint64_t now, uint64_t tick_len = 10, uint64_t seed = 1);
+
+	    /**
+	     * Fire once, `delay` from now, passing `data` to the callback
+	     */
+	    TimerId add(uint64_t delay, uint64_t data);
+
+	    /**
+	     * Fire every `interval` with up to `max_jitter` of random offset
+	     * either way, chosen afresh each time, so that routers started
+	     * together drift apart instead of sending in lockstep.  The first
+	     * firing is jittered in the same way.  Keeps firing until
+	     * cancelled.
+	     */
+	    TimerId add_periodic(uint64_t interval, uint64_t max_jitter, uint64_t data);
+
+	    /**
+	     * Stop a timer.  Returns false if it already fired (for one-shot
+	     * timers) or was cancelled.
+	     */
+	    bool cancel(TimerId id);
+
+	    /**
+	     * Push a pending timer back to `delay` from now, e.g. when a
+	     * route is heard again.  Returns false if the timer is gone.
+	     */
+	    bool refresh(TimerId id, uint64_t delay);
+
+	    /**
+	     * Move time forward to `now` and fire everything that came due,
+	     * calling `on_expired(const Expiry *timers, size_t n)` once with
+	     * the whole batch, in firing order (nothing is called if none came
+	     * due).  One-shot timers are gone by the time the callback runs
+	     * and periodic ones are already rescheduled, so the callback may
+	     * add, cancel and refresh timers freely, but must not call
+	     * advance().  Returns the number of timers fired.
+	     */
+	    template <typename F>
+	    size_t advance(uint64_t now, F &&on_expired);
+
+	    /**
+	     * Number of pending timers
+	     */
+	    size_t size() const { return m_count; }
+
+	    /**
+	     * Current time of the wheel, rounded down to a tick
+	     */
+	    uint64_t now() const { return m_start + m_tick * m_tick_len; }
+
+	private:
+	    static constexpr int LEVELS = 4;
+	    static constexpr int SLOT_BITS = 8;
+	    static constexpr uint32_t SLOTS = 1u << SLOT_BITS;
+	    static constexpr uint32_t NONE = UINT32_MAX;
+
+	    // Timers at least 2^32 ticks out wait here until the top level
+	    // wraps around
+	    static constexpr uint32_t OVERFLOW_LIST = LEVELS * SLOTS;
+
+	    struct Node {
+		uint64_t expires; // In ticks
+		uint64_t data;
+		uint64_t period;  // In ticks, 0 for one-shot timers
+		uint64_t jitter;  // In ticks
+		uint32_t prev;
+		uint32_t next;
+		uint32_t list;    // Which list the node is on, or NONE if free
+		uint32_t gen;
+	    };
+
+	    uint64_t ticks(uint64_t t) const { return (t + m_tick_len - 1) / m_tick_len; }
+	    uint64_t expiry(uint64_t delay) const;
+	    uint64_t jittered(const Node &n);
+
+	    TimerId schedule(uint64_t expires, uint64_t period, uint64_t jitter, uint64_t data);
+	    Node *lookup(TimerId id);
+	    void link(uint32_t index);
+	    void unlink(uint32_t index);
+	    void release(uint32_t index);
+	    void cascade(uint32_t list);
+	    void tick();
+
+	    uint64_t m_start;
+	    uint64_t m_tick_len;
+	    uint64_t m_tick = 0;
+	    uint64_t m_now;   // Latest time passed in, not rounded to a tick
+	    uint64_t m_rng;
+
+	    std::vector<Node> m_nodes;
+	    std::vector<uint32_t> m_heads;
+	    uint32_t m_free = NONE;
+	    size_t m_count = 0;
+
+	    std::vector<Expiry> m_expired;
+	};
+
+	/**
+	 * The timers a RIP router needs, parameterized by a Config:
+	 *  - a periodic update for each of rip_neighbors(), every
+	 *    rip_periodic_update_rate() ms, give or take a sixth of that
+	 *    (RFC 2453's 30 s +/- 5 s)
+	 *  - a timeout of rip_timeout_threshold() ms for each learned route
+	 * Routes are identified by whatever index the caller uses in its own
+	 * table.
+	 */
+	class RIPTimers {
+	public:
+	    RIPTimers(const Config &conf, uint64_t now_ms, uint64_t tick_ms = 10,
+		      uint64_t seed = std::random_device{}());
+
+	    /**
+	     * Start the timeout of route `route`
+	     */
+	    TimerId learn(uint32_t route) { return m_wheel.add(m_timeout_ms, route); }
+
+	    /**
+	     * Restart a route's timeout after hearing it again
+	     */
+	    bool refresh(TimerId t) { return m_wheel.refresh(t, m_timeout_ms); }
+
+	    /**
+	     * Stop a route's timeout, e.g. once it is withdrawn
+	     */
+	    bool forget(TimerId t) { return m_wheel.cancel(t); }
+
+	    /**
+	     * Move time forward to `now_ms`.  Calls
+	     * `advertise(const uint32_t *rip_neighbors, size_t n)` with the
+	     * indices into Config::rip_neighbors() that are due for an update,
+	     * then `expire(const uint32_t *routes, size_t n)` with the routes
+	     * whose timeout passed.  Either is skipped if it has nothing.
+	     */
+	    template <typename Advertise, typename Expire>
+	    void advance(uint64_t now_ms, Advertise &&advertise, Expire &&expire);
+
+	    TimerWheel &wheel() { return m_wheel; }
+
+	private:
+	    // Set in the data of advertisement timers
+	    static constexpr uint64_t ADVERTISE = 1ull << 63;
+
+	    TimerWheel m_wheel;
+	    uint64_t m_timeout_ms;
+	    std::vector<uint32_t> m_advertise;
+	    std::vector<uint32_t> m_expire;
+	};
+}
+
+inline lnx::TimerWheel::TimerWheel(uint64_t now, uint64_t tick_len, uint64_t seed)
+	: m_start(now), m_tick_len(tick_len == 0 ? 1 : tick_len), m_now(now), m_rng(seed | 1),
+	  m_heads(LEVELS * SLOTS + 1, NONE) {}
+
+inline lnx::TimerId lnx::TimerWheel::add(uint64_t delay, uint64_t data) {
+	return schedule(expiry(delay), 0, 0, data);
+}
+
+inline lnx::TimerId lnx::TimerWheel::add_periodic(uint64_t interval, uint64_t max_jitter,
+						   uint64_t data) {
+	uint64_t period = std::max<uint64_t>(1, ticks(interval));
+	uint64_t jitter = std::min(ticks(max_jitter), period - 1);
+	Node n = {};
+	n.period = period;
+	n.jitter = jitter;
+	return schedule(expiry(jittered(n) * m_tick_len), period, jitter, data);
+}
+
+inline bool lnx::TimerWheel::cancel(TimerId id) {
+	Node *n = lookup(id);
+	if (n == nullptr) {
+		return false;
+	}
+	uint32_t index = (uint32_t) (n - m_nodes.data());
+	unlink(index);
+	release(index);
+	return true;
+}
+
+inline bool lnx::TimerWheel::refresh(TimerId id, uint64_t delay) {
+	Node *n = lookup(id);
+	if (n == nullptr) {
+		return false;
+	}
+	uint32_t index = (uint32_t) (n - m_nodes.data());
+	unlink(index);
+	n->expires = expiry(delay);
+	link(index);
+	return true;
+}
+
+template <typename F>
+size_t lnx::TimerWheel::advance(uint64_t now, F &&on_expired) {
+	m_now = std::max(m_now, now);
+	uint64_t target = (m_now - m_start) / m_tick_len;
+	m_expired.clear();
+	while (m_tick < target) {
+		if (m_count == 0) {
+			m_tick = target;
+			break;
+		}
+		tick();
+	}
+	if (!m_expired.empty()) {
+		on_expired(m_expired.data(), m_expired.size());
+	}
+	return m_expired.size();
+}
+
+// First tick at or after `delay` from now.  Counted from the exact time
+// rather than from m_tick, which is rounded down and would let a timer
+// fire up to a tick early.  Always a future tick, since the current one
+// has been handled.
+inline uint64_t lnx::TimerWheel::expiry(uint64_t delay) const {
+	return std::max(m_tick + 1, ticks(m_now - m_start + delay));
+}
+
+// Next delay of periodic timer `n`: its period, plus or minus up to its
+// jitter (xorshift64)
+inline uint64_t lnx::TimerWheel::jittered(const Node &n) {
+	if (n.jitter == 0) {
+		return n.period;
+	}
+	m_rng ^= m_rng << 13;
+	m_rng ^= m_rng >> 7;
+	m_rng ^= m_rng << 17;
+	return n.period - n.jitter + m_rng % (2 * n.jitter + 1);
+}
+
+inline lnx::TimerId lnx::TimerWheel::schedule(uint64_t expires, uint64_t period, uint64_t jitter,
+					       uint64_t data) {
+	uint32_t index = m_free;
+	if (index == NONE) {
+		index = (uint32_t) m_nodes.size();
+		m_nodes.push_back({});
+		m_nodes.back().gen = 1;
+	} else {
+		m_free = m_nodes[index].next;
+	}
+
+	Node &n = m_nodes[index];
+	n.expires = expires;
+	n.data = data;
+	n.period = period;
+	n.jitter = jitter;
+	link(index);
+	m_count++;
+	return ((uint64_t) n.gen << 32) | index;
+}
+
+inline lnx::TimerWheel::Node *lnx::TimerWheel::lookup(TimerId id) {
+	uint32_t index = (uint32_t) id;
+	if (index >= m_nodes.size()) {
+		return nullptr;
+	}
+	Node &n = m_nodes[index];
+	return n.gen == (uint32_t) (id >> 32) && n.list != NONE ? &n : nullptr;
+}
+
+// Put a node on the list for its expiry time: the lowest level whose
+// higher digits match the current tick, in the slot for its digit at
+// that level.  Otherwise that slot could alias one that is due sooner.
+inline void lnx::TimerWheel::link(uint32_t index) {
+	Node &n = m_nodes[index];
+	uint32_t list = OVERFLOW_LIST;
+	for (int level = 0; level < LEVELS; level++) {
+		int shift = SLOT_BITS * (level + 1);
+		if ((n.expires >> shift) == (m_tick >> shift)) {
+			list = level * SLOTS + ((n.expires >> (SLOT_BITS * level)) & (SLOTS - 1));
+			break;
+		}
+	}
+
+	n.list = list;
+	n.prev = NONE;
+	n.next = m_heads[list];
+	if (n.next != NONE) {
+		m_nodes[n.next].prev = index;
+	}
+	m_heads[list] = index;
+}
+
+inline void lnx::TimerWheel::unlink(uint32_t index) {
+	Node &n = m_nodes[index];
+	if (n.prev != NONE) {
+		m_nodes[n.prev].next = n.next;
+	} else {
+		m_heads[n.list] = n.next;
+	}
+	if (n.next != NONE) {
+		m_nodes[n.next].prev = n.prev;
+	}
+}
+
+inline void lnx::TimerWheel::release(uint32_t index) {
+	Node &n = m_nodes[index];
+	n.list = NONE;
+	n.gen = n.gen == UINT32_MAX ? 1 : n.gen + 1;
+	n.next = m_free;
+	m_free = index;
+	m_count--;
+}
+
+// Re-file every node of `list` relative to the current tick
+inline void lnx::TimerWheel::cascade(uint32_t list) {
+	uint32_t index = m_heads[list];
+	m_heads[list] = NONE;
+	while (index != NONE) {
+		uint32_t next = m_nodes[index].next;
+		link(index);
+		index = next;
+	}
+}
+
+inline void lnx::TimerWheel::tick() {
+	m_tick++;
+
+	// At each level boundary, spread the next slot of the level above
+	// over the levels below.  Highest first, since a higher level can
+	// refill a lower one's slot that is due at this same tick.
+	if ((m_tick & 0xffffffffull) == 0) {
+		cascade(OVERFLOW_LIST);
+	}
+	for (int level = LEVELS - 1; level > 0; level--) {
+		int shift = SLOT_BITS * level;
+		if ((m_tick & ((1ull << shift) - 1)) == 0) {
+			cascade(level * SLOTS + ((m_tick >> shift) & (SLOTS - 1)));
+		}
+	}
+
+	uint32_t list = (uint32_t) (m_tick & (SLOTS - 1));
+	uint32_t index = m_heads[list];
+	m_heads[list] = NONE;
+	while (index != NONE) {
+		Node &n = m_nodes[index];
+		uint32_t next = n.next;
+		uint32_t gen = n.gen;
+		m_expired.push_back({((uint64_t) gen << 32) | index, n.data});
+		if (n.period != 0) {
+			n.expires = m_tick + jittered(n);
+			link(index);
+		} else {
+			release(index);
+		}
+		index = next;
+	}
+}
+
+inline lnx::RIPTimers::RIPTimers(const Config &conf, uint64_t now_ms, uint64_t tick_ms,
+				  uint64_t seed)
+	: m_wheel(now_ms, tick_ms, seed), m_timeout_ms(conf.rip_timeout_threshold()) {
+	uint64_t period = conf.rip_periodic_update_rate();
+	for (uint32_t i = 0; i < conf.rip_neighbors().size(); i++) {
+		m_wheel.add_periodic(period, period / 6, ADVERTISE | i);
+	}
+}
+
+template <typename Advertise, typename Expire>
+void lnx::RIPTimers::advance(uint64_t now_ms, Advertise &&advertise, Expire &&expire) {
+	m_advertise.clear();
+	m_expire.clear();
+	m_wheel.advance(now_ms, [&](const Expiry *timers, size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			if (timers[i].data & ADVERTISE) {
+				m_advertise.push_back((uint32_t) timers[i].data);
+			} else {
+				m_expire.push_back((uint32_t) timers[i].data);
+			}
+		}
+	});
+	if (!m_advertise.empty()) {
+		advertise(m_advertise.data(), m_advertise.size());
+	}
+	if (!m_expire.empty()) {
+		expire(m_expire.data(), m_expire.size());
+	}
+}
+
+#endif // __LNXTIMER_H__
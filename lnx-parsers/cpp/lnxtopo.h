@@ -0,0 +1,292 @@
+/*
+ * lnxtopo.h - Cross-checking the configs of a whole network
+ *
+ * Companion to lnxconfig.h.  lnx::Topology takes the configs of every
+ * node in a network, matches each `neighbor` line to the interface it
+ * points at, and reports links that do not line up.  The resulting link
+ * graph is kept in compressed sparse row (CSR) form for traversal.
+ */
+
+#ifndef __LNXTOPO_H__
+#define __LNXTOPO_H__
+
+#include "lnxconfig.h"
+
+namespace lnx {
+
+	/**
+	 * A neighbor line resolved to the interface it names: node `node`
+	 * reaches interface `peer_ifindex` of node `peer_node` through its
+	 * own interface `ifindex`, as declared by its `neighbor`-th
+	 * neighbor.  Node numbers are positions in the vector passed to
+	 * Topology.
+	 */
+	struct TopoLink {
+		uint32_t node;
+		uint32_t ifindex;
+		uint32_t neighbor;
+		uint32_t peer_node;
+		uint32_t peer_ifindex;
+
+		/**
+		 * Whether the peer has a neighbor line pointing back over the
+		 * same pair of interfaces
+		 */
+		bool symmetric;
+	};
+
+	/**
+	 * Something wrong with the network as a whole
+	 */
+	struct TopoIssue {
+		enum Kind {
+			/**
+			 * No interface binds the neighbor's UDP address and port,
+			 * or the neighbor's `via` interface does not exist
+			 */
+			DANGLING,
+
+			/**
+			 * The interface at the neighbor's UDP endpoint does not have
+			 * the neighbor's IP address
+			 */
+			ADDRESS_MISMATCH,
+
+			/**
+			 * The two ends of a link are not on the same subnet
+			 */
+			SUBNET_MISMATCH,
+
+			/**
+			 * The peer has no neighbor line for the reverse direction
+			 */
+			ASYMMETRIC,
+
+			/**
+			 * The same link is declared twice, or two interfaces share a
+			 * UDP endpoint or an IP address
+			 */
+			DUPLICATE,
+		};
+
+		Kind kind;
+
+		/**
+		 * Node the issue was found on
+		 */
+		uint32_t node;
+
+		/**
+		 * Index into the node's neighbors(), or -1 for issues about an
+		 * interface (duplicate endpoints and addresses)
+		 */
+		int neighbor;
+
+		/**
+		 * Human-readable description, naming nodes by number
+		 */
+		std::string msg;
+	};
+
+	class Topology {
+	public:
+	    /**
+	     * Resolve every neighbor of every node.  Interfaces are joined to
+	     * neighbors through hash tables keyed by UDP endpoint and by IP
+	     * address, so this takes time linear in the total number of
+	     * interfaces and neighbors.  The configs must outlive the
+	     * Topology only if the caller keeps indexing into them.
+	     */
+	    explicit Topology(const std::vector<const Config *> &nodes);
+
+	    size_t num_nodes() const { return m_link_start.size() - 1; }
+
+	    /**
+	     * Resolved links, grouped by node in node order
+	     */
+	    const std::vector<TopoLink> &links() const { return m_links; }
+
+	    /**
+	     * Links of `node`: entries [link_offset(node), link_offset(node + 1))
+	     * of links()
+	     */
+	    size_t link_offset(uint32_t node) const { return m_link_start[node]; }
+
+	    /**
+	     * Peer node of each of `node`'s links, in the same order as its
+	     * entries in links()
+	     */
+	    IndexRange peers(uint32_t node) const;
+
+	    /**
+	     * Problems found: duplicate interfaces, then per-neighbor problems,
+	     * then duplicate and asymmetric links, each in node order
+	     */
+	    const std::vector<TopoIssue> &issues() const { return m_issues; }
+
+	private:
+	    std::vector<TopoLink> m_links;
+	    std::vector<uint32_t> m_link_start;
+	    std::vector<uint32_t> m_peers;
+	    std::vector<TopoIssue> m_issues;
+	};
+}
+
+inline lnx::Topology::Topology(const std::vector<const Config *> &nodes) {
+	// Every interface in the network, as (node, ifindex)
+	struct IfRef {
+		uint32_t node;
+		uint32_t ifindex;
+	};
+	std::vector<IfRef> ifaces;
+	for (uint32_t n = 0; n < nodes.size(); n++) {
+		for (uint32_t i = 0; i < nodes[n]->interfaces().size(); i++) {
+			ifaces.push_back({n, i});
+		}
+	}
+	auto iface = [&](const IfRef &r) -> const Interface & {
+		return nodes[r.node]->interfaces()[r.ifindex];
+	};
+
+	// Build side of the joins: UDP endpoint -> interface, IP -> interface
+	detail::FlatIndex by_endpoint, by_addr;
+	by_endpoint.reset(ifaces.size());
+	by_addr.reset(ifaces.size());
+	for (uint32_t k = 0; k < ifaces.size(); k++) {
+		const Interface &i = iface(ifaces[k]);
+		uint64_t ep = detail::endpoint_key(i.udp_addr, i.udp_port);
+		auto same_ep = [&](uint32_t pos) {
+			const Interface &o = iface(ifaces[pos]);
+			return detail::endpoint_key(o.udp_addr, o.udp_port) == ep;
+		};
+		auto same_addr = [&](uint32_t pos) {
+			return iface(ifaces[pos]).assigned_ip.s_addr == i.assigned_ip.s_addr;
+		};
+
+		if (!by_endpoint.insert(detail::hash_u64(ep), k, same_ep)) {
+			const IfRef &o = ifaces[by_endpoint.find(detail::hash_u64(ep), same_ep)];
+			m_issues.push_back({TopoIssue::DUPLICATE, ifaces[k].node, -1,
+					    "interface " + i.name + " binds " +
+					    detail::endpoint_str(i.udp_addr, i.udp_port) +
+					    ", already bound by node " + std::to_string(o.node) +
+					    " interface " + iface(o).name});
+		}
+		if (!by_addr.insert(detail::hash_u32(i.assigned_ip.s_addr), k, same_addr)) {
+			const IfRef &o = ifaces[by_addr.find(detail::hash_u32(i.assigned_ip.s_addr), same_addr)];
+			m_issues.push_back({TopoIssue::DUPLICATE, ifaces[k].node, -1,
+					    "interface " + i.name + " has address " +
+					    detail::addr_str(i.assigned_ip) + ", also on node " +
+					    std::to_string(o.node) + " interface " + iface(o).name});
+		}
+	}
+
+	// Probe side: resolve each neighbor.  Links come out grouped by
+	// node, so the CSR offsets are just running counts.
+	m_link_start.push_back(0);
+	for (uint32_t n = 0; n < nodes.size(); n++) {
+		const std::vector<Neighbor> &neighbors = nodes[n]->neighbors();
+		for (uint32_t j = 0; j < neighbors.size(); j++) {
+			const Neighbor &nb = neighbors[j];
+			auto what = [&] {
+				return "neighbor " + detail::addr_str(nb.dest_addr) + " at " +
+				       detail::endpoint_str(nb.udp_addr, nb.udp_port);
+			};
+
+			if (nb.ifindex < 0) {
+				m_issues.push_back({TopoIssue::DANGLING, n, (int) j,
+						    what() + " is via unknown interface " + nb.ifname});
+				continue;
+			}
+
+			uint64_t ep = detail::endpoint_key(nb.udp_addr, nb.udp_port);
+			uint32_t k = by_endpoint.find(detail::hash_u64(ep), [&](uint32_t pos) {
+				const Interface &o = iface(ifaces[pos]);
+				return detail::endpoint_key(o.udp_addr, o.udp_port) == ep;
+			});
+			if (k == detail::FlatIndex::NONE) {
+				std::string msg = what() + ": no interface binds that endpoint";
+				uint32_t a = by_addr.find(detail::hash_u32(nb.dest_addr.s_addr), [&](uint32_t pos) {
+					return iface(ifaces[pos]).assigned_ip.s_addr == nb.dest_addr.s_addr;
+				});
+				if (a != detail::FlatIndex::NONE) {
+					msg += " (" + detail::addr_str(nb.dest_addr) + " is node " +
+					       std::to_string(ifaces[a].node) + " interface " + iface(ifaces[a]).name +
+					       " at " + detail::endpoint_str(iface(ifaces[a]).udp_addr,
+									    iface(ifaces[a]).udp_port) + ")";
+				}
+				m_issues.push_back({TopoIssue::DANGLING, n, (int) j, msg});
+				continue;
+			}
+
+			const IfRef &peer = ifaces[k];
+			const Interface &local = nodes[n]->interfaces()[nb.ifindex];
+			const Interface &remote = iface(peer);
+			std::string peer_name = "node " + std::to_string(peer.node) + " interface " + remote.name;
+
+			if (remote.assigned_ip.s_addr != nb.dest_addr.s_addr) {
+				m_issues.push_back({TopoIssue::ADDRESS_MISMATCH, n, (int) j,
+						    what() + " reaches " + peer_name + ", which has address " +
+						    detail::addr_str(remote.assigned_ip)});
+			}
+
+			uint32_t mask = local.prefix_len == 0 ? 0 : htonl(~0u << (32 - local.prefix_len));
+			if (local.prefix_len != remote.prefix_len ||
+			    (local.assigned_ip.s_addr & mask) != (remote.assigned_ip.s_addr & mask)) {
+				m_issues.push_back({TopoIssue::SUBNET_MISMATCH, n, (int) j,
+						    what() + ": interface " + local.name + " and " + peer_name +
+						    " are on different subnets"});
+			}
+
+			m_links.push_back({n, (uint32_t) nb.ifindex, j, peer.node, peer.ifindex, false});
+			m_peers.push_back(peer.node);
+		}
+		m_link_start.push_back((uint32_t) m_links.size());
+	}
+
+	// Self-join the links on (node, ifindex, peer_node, peer_ifindex) to
+	// find repeats and check that each has a reverse
+	auto link_hash = [](uint32_t a, uint32_t ai, uint32_t b, uint32_t bi) {
+		return detail::hash_u32(detail::hash_u32(a ^ (ai << 20)) ^ b ^ (bi << 20));
+	};
+	detail::FlatIndex by_link;
+	by_link.reset(m_links.size());
+	for (uint32_t k = 0; k < m_links.size(); k++) {
+		const TopoLink &l = m_links[k];
+		bool fresh = by_link.insert(link_hash(l.node, l.ifindex, l.peer_node, l.peer_ifindex), k,
+					    [&](uint32_t pos) {
+			const TopoLink &o = m_links[pos];
+			return o.node == l.node && o.ifindex == l.ifindex &&
+			       o.peer_node == l.peer_node && o.peer_ifindex == l.peer_ifindex;
+		});
+		if (!fresh) {
+			const Neighbor &nb = nodes[l.node]->neighbors()[l.neighbor];
+			m_issues.push_back({TopoIssue::DUPLICATE, l.node, (int) l.neighbor,
+					    "neighbor " + detail::addr_str(nb.dest_addr) +
+					    " repeats an earlier neighbor line for the same link"});
+		}
+	}
+
+	for (TopoLink &l : m_links) {
+		uint32_t r = by_link.find(link_hash(l.peer_node, l.peer_ifindex, l.node, l.ifindex),
+					  [&](uint32_t pos) {
+			const TopoLink &o = m_links[pos];
+			return o.node == l.peer_node && o.ifindex == l.peer_ifindex &&
+			       o.peer_node == l.node && o.peer_ifindex == l.ifindex;
+		});
+		l.symmetric = r != detail::FlatIndex::NONE;
+		if (!l.symmetric) {
+			const Neighbor &nb = nodes[l.node]->neighbors()[l.neighbor];
+			m_issues.push_back({TopoIssue::ASYMMETRIC, l.node, (int) l.neighbor,
+					    "neighbor " + detail::addr_str(nb.dest_addr) + ": node " +
+					    std::to_string(l.peer_node) + " has no neighbor line back to interface " +
+					    nodes[l.node]->interfaces()[l.ifindex].name});
+		}
+	}
+}
+
+inline lnx::IndexRange lnx::Topology::peers(uint32_t node) const {
+	const uint32_t *base = m_peers.data();
+	return {base + m_link_start[node], base + m_link_start[node + 1]};
+}
+
+#endif // __LNXTOPO_H__